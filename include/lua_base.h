@@ -1,118 +1,260 @@
-﻿#pragma once
-
-#include <mutex>
-#include <format>
-#include <atomic>
-#include <string>
-#include <cstdint>
-#include <cstring>
-#include <concepts>
-#include <stdexcept>
-#include <functional>
-#include <type_traits>
-#include <string_view>
-#include <unordered_map>
-
-extern "C" {
-    #include "lua.h"
-    #include "lualib.h"
-    #include "lauxlib.h"
-}
-
-using pchar     = char*;
-using pbyte     = uint8_t*;
-using cpchar    = const char*;
-using upchar    = unsigned char*;
-using cpbyte    = const uint8_t*;
-using sstring   = std::string;
-using vstring   = std::string_view;
-using cstring   = const std::string;
-using cvstring  = const std::string_view;
-
-namespace luakit {
-
-    //升级cpp23后使用标准库接口
-    template <std::integral T>
-    constexpr T byteswap(T value) noexcept {
-        auto* bytes = reinterpret_cast<unsigned char*>(&value);
-        for (std::size_t i = 0; i < sizeof(T) / 2; ++i) {
-            std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
-        }
-        return value;
-    }
-
-    template<typename T>
-    cpchar lua_get_meta_name() {
-        using OT = std::remove_cv_t<std::remove_pointer_t<T>>;
-        return typeid(OT).name();
-    }
-
-    inline size_t lua_get_object_key(void* obj) {
-        return (size_t)obj;
-    }
-
-    class lua_guard {
-    public:
-        lua_guard(lua_State* L) : m_L(L) { m_top = lua_gettop(L); }
-        ~lua_guard() { lua_settop(m_L, m_top); }
-        lua_guard(const lua_guard& other) = delete;
-        lua_guard(lua_guard&& other) = delete;
-        lua_guard& operator =(const lua_guard&) = delete;
-    private:
-        int m_top = 0;
-        lua_State* m_L = nullptr;
-    };
-
-    class lua_exception : public std::logic_error {
-    public:
-        template <class... Args>
-        explicit lua_exception(cpchar fmt, Args&&... args) : std::logic_error(format(fmt, std::forward<Args>(args)...)) {}
-
-    protected:
-        template <class... Args>
-        std::string format(cpchar fmt, Args&&... args) {
-            try {
-                return std::vformat(fmt, std::make_format_args(args...));
-            } catch (const std::format_error& e) {
-                return "Format error: " + std::string(e.what());
-            }
-        }
-    };
-
-    class spin_mutex {
-    public:
-        spin_mutex() = default;
-        spin_mutex(const spin_mutex&) = delete;
-        spin_mutex& operator = (const spin_mutex&) = delete;
-        void lock() {
-            for (;;) {
-                if (!flag.test_and_set(std::memory_order_relaxed)) {
-                    std::atomic_thread_fence(std::memory_order_acquire);
-                    break;
-                }
-                #if defined(_M_X64) || defined(_M_IX86)
-                    _mm_pause();
-                #elif defined(__x86_64__) || defined(__i386__)
-                    __builtin_ia32_pause();
-                #elif defined(__aarch64__) || defined(__arm64__)
-                    #if defined(__APPLE__)
-                        __asm__ volatile("yield");
-                    #else
-                        __builtin_arm_yield();
-                    #endif
-                #else
-                    std::this_thread::yield();
-                #endif
-            }
-        }
-        bool try_lock() {
-            return !flag.test_and_set(std::memory_order_acquire);
-        }
-        void unlock() {
-            flag.clear(std::memory_order_release);
-        }
-    private:
-        std::atomic_flag flag = ATOMIC_FLAG_INIT;
-    }; //spin_mutex
-
-}
+﻿#pragma once
+
+#include <bit>
+#include <mutex>
+#include <memory>
+#include <format>
+#include <atomic>
+#include <limits>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <concepts>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+#include <string_view>
+#include <unordered_map>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define LUAKIT_SIMD_X64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+//按函数开启指令集，不需要整体以-mssse3/-mavx2编译，调用前需检测cpu支持
+#if defined(__GNUC__) || defined(__clang__)
+#define LUAKIT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define LUAKIT_TARGET(isa)
+#endif
+
+#ifdef WIN32
+struct iovec {
+    void*   iov_base;
+    size_t  iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
+extern "C" {
+    #include "lua.h"
+    #include "lualib.h"
+    #include "lauxlib.h"
+}
+
+using pchar     = char*;
+using pbyte     = uint8_t*;
+using cpchar    = const char*;
+using upchar    = unsigned char*;
+using cpbyte    = const uint8_t*;
+using sstring   = std::string;
+using vstring   = std::string_view;
+using cstring   = const std::string;
+using cvstring  = const std::string_view;
+
+namespace luakit {
+
+    //升级cpp23后使用标准库接口
+    template <std::integral T>
+    constexpr T byteswap(T value) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+        if constexpr (sizeof(T) == 2) {
+            return (T)__builtin_bswap16((uint16_t)value);
+        } else if constexpr (sizeof(T) == 4) {
+            return (T)__builtin_bswap32((uint32_t)value);
+        } else if constexpr (sizeof(T) == 8) {
+            return (T)__builtin_bswap64((uint64_t)value);
+        }
+#endif
+        auto* bytes = reinterpret_cast<unsigned char*>(&value);
+        for (std::size_t i = 0; i < sizeof(T) / 2; ++i) {
+            std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+        }
+        return value;
+    }
+
+    template <size_t N>
+    using swap_uint = std::conditional_t<N == 2, uint16_t, std::conditional_t<N == 4, uint32_t, uint64_t>>;
+
+#ifdef LUAKIT_SIMD_X64
+    //运行时检测的cpu特性，首次使用时初始化
+    struct cpu_features {
+        bool ssse3 = false;
+        bool sse42 = false;
+        bool avx2 = false;
+        cpu_features() {
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 1);
+            ssse3 = (info[2] & (1 << 9)) != 0;
+            sse42 = (info[2] & (1 << 20)) != 0;
+#if defined(__AVX2__)
+            avx2 = true;
+#endif
+#else
+            //静态构造阶段cpu信息可能尚未初始化，需先调用__builtin_cpu_init
+            __builtin_cpu_init();
+            ssse3 = __builtin_cpu_supports("ssse3");
+            sse42 = __builtin_cpu_supports("sse4.2");
+            avx2 = __builtin_cpu_supports("avx2");
+#endif
+        }
+    };
+
+    inline const cpu_features& cpu_support() {
+        static const cpu_features features;
+        return features;
+    }
+
+    //每个元素内翻转字节的shuffle掩码
+    template <size_t N>
+    inline void byteswap_mask(uint8_t* mask, size_t len) {
+        for (size_t j = 0; j < len; ++j) {
+            mask[j] = (uint8_t)((j % 16) / N * N + (N - 1 - j % N));
+        }
+    }
+
+    //从第i个元素开始，每次处理16字节，返回处理到的位置
+    template <size_t N>
+    LUAKIT_TARGET("ssse3") size_t byteswap_ssse3(uint8_t* dest, const uint8_t* src, size_t i, size_t count) noexcept {
+        alignas(16) uint8_t mask[16];
+        byteswap_mask<N>(mask, 16);
+        const __m128i mask128 = _mm_load_si128((const __m128i*)mask);
+        for (; (i + 16 / N) <= count; i += 16 / N) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + i * N));
+            _mm_storeu_si128((__m128i*)(dest + i * N), _mm_shuffle_epi8(v, mask128));
+        }
+        return i;
+    }
+
+    template <size_t N>
+    LUAKIT_TARGET("avx2") size_t byteswap_avx2(uint8_t* dest, const uint8_t* src, size_t i, size_t count) noexcept {
+        alignas(32) uint8_t mask[32];
+        byteswap_mask<N>(mask, 32);
+        const __m256i mask256 = _mm256_load_si256((const __m256i*)mask);
+        for (; (i + 32 / N) <= count; i += 32 / N) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(src + i * N));
+            _mm256_storeu_si256((__m256i*)(dest + i * N), _mm256_shuffle_epi8(v, mask256));
+        }
+        return i;
+    }
+#endif
+
+    //批量翻转字节序，dest可以和src相同
+    //x86-64运行时选择AVX2/SSSE3，ARM使用NEON，剩余的元素逐个翻转
+    template <typename T>
+    void byteswap_array(T* dest, const T* src, size_t count) noexcept {
+        constexpr size_t N = sizeof(T);
+        static_assert(N == 1 || N == 2 || N == 4 || N == 8, "invalid element size");
+        if constexpr (N == 1) {
+            if (dest != src) memmove(dest, src, count);
+            return;
+        } else {
+            size_t i = 0;
+            auto* sbytes = reinterpret_cast<const uint8_t*>(src);
+            auto* dbytes = reinterpret_cast<uint8_t*>(dest);
+#if defined(LUAKIT_SIMD_X64)
+            const cpu_features& cpu = cpu_support();
+            if (cpu.avx2) i = byteswap_avx2<N>(dbytes, sbytes, i, count);
+            if (cpu.ssse3) i = byteswap_ssse3<N>(dbytes, sbytes, i, count);
+#elif defined(__ARM_NEON)
+            for (; (i + 16 / N) <= count; i += 16 / N) {
+                uint8x16_t v = vld1q_u8(sbytes + i * N);
+                if constexpr (N == 2) v = vrev16q_u8(v);
+                else if constexpr (N == 4) v = vrev32q_u8(v);
+                else v = vrev64q_u8(v);
+                vst1q_u8(dbytes + i * N, v);
+            }
+#endif
+            for (; i < count; ++i) {
+                swap_uint<N> v;
+                memcpy(&v, sbytes + i * N, N);
+                v = byteswap(v);
+                memcpy(dbytes + i * N, &v, N);
+            }
+        }
+    }
+
+    template<typename T>
+    cpchar lua_get_meta_name() {
+        using OT = std::remove_cv_t<std::remove_pointer_t<T>>;
+        return typeid(OT).name();
+    }
+
+    inline size_t lua_get_object_key(void* obj) {
+        return (size_t)obj;
+    }
+
+    class lua_guard {
+    public:
+        lua_guard(lua_State* L) : m_L(L) { m_top = lua_gettop(L); }
+        ~lua_guard() { lua_settop(m_L, m_top); }
+        lua_guard(const lua_guard& other) = delete;
+        lua_guard(lua_guard&& other) = delete;
+        lua_guard& operator =(const lua_guard&) = delete;
+    private:
+        int m_top = 0;
+        lua_State* m_L = nullptr;
+    };
+
+    class lua_exception : public std::logic_error {
+    public:
+        template <class... Args>
+        explicit lua_exception(cpchar fmt, Args&&... args) : std::logic_error(format(fmt, std::forward<Args>(args)...)) {}
+
+    protected:
+        template <class... Args>
+        std::string format(cpchar fmt, Args&&... args) {
+            try {
+                return std::vformat(fmt, std::make_format_args(args...));
+            } catch (const std::format_error& e) {
+                return "Format error: " + std::string(e.what());
+            }
+        }
+    };
+
+    class spin_mutex {
+    public:
+        spin_mutex() = default;
+        spin_mutex(const spin_mutex&) = delete;
+        spin_mutex& operator = (const spin_mutex&) = delete;
+        void lock() {
+            for (;;) {
+                if (!flag.test_and_set(std::memory_order_relaxed)) {
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    break;
+                }
+                #if defined(_M_X64) || defined(_M_IX86)
+                    _mm_pause();
+                #elif defined(__x86_64__) || defined(__i386__)
+                    __builtin_ia32_pause();
+                #elif defined(__aarch64__) || defined(__arm64__)
+                    #if defined(__APPLE__)
+                        __asm__ volatile("yield");
+                    #else
+                        __builtin_arm_yield();
+                    #endif
+                #else
+                    std::this_thread::yield();
+                #endif
+            }
+        }
+        bool try_lock() {
+            return !flag.test_and_set(std::memory_order_acquire);
+        }
+        void unlock() {
+            flag.clear(std::memory_order_release);
+        }
+    private:
+        std::atomic_flag flag = ATOMIC_FLAG_INIT;
+    }; //spin_mutex
+
+}
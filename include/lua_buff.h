@@ -1,5 +1,12 @@
 #pragma once
 
+#ifndef WIN32
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "lua_time.h"
 #include "lua_slice.h"
 
 namespace luakit {
@@ -7,19 +14,202 @@ namespace luakit {
     const size_t BUFFER_DEF = 64 * 1024;        //64K
     const size_t BUFFER_MAX = 16 * 1024 * 1024; //16M
     const size_t ALIGN_SIZE = 16;               //水位
+    const size_t POOL_CLASS = 9;                //64K ~ 16M
+    const size_t POOL_BUDGET = 4 * 1024 * 1024; //每个规格缓存上限(4M, 至少缓存1块)
+    const size_t READ_MIN = 4 * 1024;           //read_from单次读取下限
+    const size_t READ_MAX = 1024 * 1024;        //read_from单次读取上限
+    const size_t READ_SCRATCH = 64 * 1024;      //read_from栈上溢出块
+
+    //fd读写状态
+    const int io_ok     = 0;
+    const int io_again  = 1;    //EAGAIN
+    const int io_eof    = 2;    //对端关闭
+    const int io_error  = 3;    //其他错误，见errno
+
+    //buff统计，定义LUAKIT_BUFF_STATS后生效
+    struct buff_stats {
+        size_t resizes = 0;         //重新分配次数
+        size_t compacts = 0;        //整理内存次数
+        size_t moved = 0;           //整理和重新分配时移动的字节数
+        size_t peak = 0;            //容量峰值
+        size_t space_fails = 0;     //peek_space失败次数(达到BUFFER_MAX)
+        uint64_t max_time = 0;      //处于BUFFER_MAX容量的时长(ns)
+
+        void merge(const buff_stats& other) {
+            resizes += other.resizes;
+            compacts += other.compacts;
+            moved += other.moved;
+            space_fails += other.space_fails;
+            max_time += other.max_time;
+            peak = std::max(peak, other.peak);
+        }
+    };
+
+#ifdef LUAKIT_BUFF_STATS
+    //当前线程所有luabuf的汇总
+    inline thread_local buff_stats t_buff_stats;
+#endif
+
+    //buff内存分配策略
+    class buff_alloc {
+    public:
+        virtual ~buff_alloc() {}
+        virtual uint8_t* alloc(size_t size) = 0;
+        virtual void release(uint8_t* data, size_t size) = 0;
+    };
+
+    //直接使用堆分配
+    class heap_alloc : public buff_alloc {
+    public:
+        virtual uint8_t* alloc(size_t size) {
+            return (uint8_t*)malloc(size);
+        }
+        virtual void release(uint8_t* data, size_t) {
+            free(data);
+        }
+    };
+
+    //按规格缓存的内存池，规格为BUFFER_DEF的2次幂倍
+    class size_pool {
+    public:
+        ~size_pool() {
+            trim(0);
+        }
+
+        uint8_t* alloc(size_t size) {
+            int index = class_index(size);
+            if (index >= 0 && !m_blocks[index].empty()) {
+                uint8_t* data = m_blocks[index].back();
+                m_blocks[index].pop_back();
+                m_hits++;
+                return data;
+            }
+            m_misses++;
+            return (uint8_t*)malloc(size);
+        }
+
+        void release(uint8_t* data, size_t size) {
+            int index = class_index(size);
+            if (index < 0) {
+                free(data);
+                return;
+            }
+            auto& blocks = m_blocks[index];
+            if (blocks.size() < std::max<size_t>(1, m_budget / size)) {
+                blocks.push_back(data);
+                return;
+            }
+            free(data);
+        }
+
+        //释放缓存的块，保留不超过keep字节(从小规格开始保留)，返回释放的字节数
+        size_t trim(size_t keep = 0) {
+            size_t freed = 0;
+            for (size_t i = 0; i < POOL_CLASS; ++i) {
+                size_t size = BUFFER_DEF << i;
+                auto& blocks = m_blocks[i];
+                while (!blocks.empty()) {
+                    if (keep >= size) {
+                        keep -= size;
+                    } else {
+                        freed += size;
+                        free(blocks.back());
+                    }
+                    blocks.pop_back();
+                }
+            }
+            return freed;
+        }
+
+        //每个规格的缓存上限，超出部分立即释放
+        void set_budget(size_t budget) {
+            m_budget = budget;
+            for (size_t i = 0; i < POOL_CLASS; ++i) {
+                size_t size = BUFFER_DEF << i;
+                auto& blocks = m_blocks[i];
+                while (blocks.size() > std::max<size_t>(1, m_budget / size)) {
+                    free(blocks.back());
+                    blocks.pop_back();
+                }
+            }
+        }
+
+        size_t hits() { return m_hits; }
+        size_t misses() { return m_misses; }
+
+        size_t cached() {
+            size_t size = 0;
+            for (size_t i = 0; i < POOL_CLASS; ++i) {
+                size += m_blocks[i].size() * (BUFFER_DEF << i);
+            }
+            return size;
+        }
+
+    protected:
+        int class_index(size_t size) {
+            for (size_t i = 0; i < POOL_CLASS; ++i) {
+                if ((BUFFER_DEF << i) == size) return (int)i;
+            }
+            return -1;
+        }
+
+    private:
+        size_t m_hits = 0;
+        size_t m_misses = 0;
+        size_t m_budget = POOL_BUDGET;
+        std::vector<uint8_t*> m_blocks[POOL_CLASS];
+    };
+
+    //线程内存池析构后(如静态luabuf晚于线程退出释放)不能再访问，标记独立存放，本身无需析构
+    inline thread_local bool t_pool_closed = false;
+
+    struct pool_holder {
+        size_pool pool;
+        ~pool_holder() { t_pool_closed = true; }
+    };
+
+    inline thread_local pool_holder t_pool_holder;
+
+    inline size_pool* thread_pool() {
+        return t_pool_closed ? nullptr : &t_pool_holder.pool;
+    }
+
+    //默认策略：使用当前线程的内存池，内存池析构后直接使用堆
+    class pool_alloc : public buff_alloc {
+    public:
+        virtual uint8_t* alloc(size_t size) {
+            size_pool* pool = thread_pool();
+            return pool ? pool->alloc(size) : (uint8_t*)malloc(size);
+        }
+        virtual void release(uint8_t* data, size_t size) {
+            size_pool* pool = thread_pool();
+            pool ? pool->release(data, size) : free(data);
+        }
+    };
+
+    inline buff_alloc* default_alloc() {
+        static pool_alloc alloc;
+        return &alloc;
+    }
 
     class luabuf {
     public:
-        luabuf() { _alloc(); }
-        ~luabuf() { free(m_data); }
+        luabuf(buff_alloc* alloc = default_alloc()) : m_alloc(alloc) { _alloc(); }
+        ~luabuf() {
+            _stat_size(0);
+            m_alloc->release(m_data, m_size);
+        }
 
         inline void reset() {
             if (m_size != BUFFER_DEF) {
-                m_data = (uint8_t*)realloc(m_data, BUFFER_DEF);
+                _stat_size(BUFFER_DEF);
+                m_alloc->release(m_data, m_size);
+                m_data = m_alloc->alloc(BUFFER_DEF);
             }
             m_end = m_data + BUFFER_DEF;
             m_head = m_tail = m_data;
             m_size = BUFFER_DEF;
+            m_slice.expire();
         }
 
         inline size_t size() {
@@ -34,6 +224,17 @@ namespace luakit {
             return m_tail == m_head;
         }
 
+#ifdef LUAKIT_BUFF_STATS
+        //本buff的统计，包含进行中的BUFFER_MAX时长
+        inline buff_stats stats() {
+            buff_stats stats = m_stats;
+            if (m_max_since > 0) {
+                stats.max_time += steady_ns() - m_max_since;
+            }
+            return stats;
+        }
+#endif
+
         inline uint8_t* head() {
             return m_head;
         }
@@ -44,6 +245,7 @@ namespace luakit {
                 _resize(m_size / 2);
             }
             m_head = m_tail = m_data;
+            m_slice.expire();
         }
 
         inline size_t copy(size_t offset, cpbyte src, size_t src_len) {
@@ -96,7 +298,6 @@ namespace luakit {
                 m_head += erase_len;
                 size_t data_len = (size_t)(m_tail - m_head);
                 if (m_size > m_max && data_len < BUFFER_DEF) {
-                    _regularize();
                     _resize(m_size / 2);
                 }
                 return erase_len;
@@ -137,10 +338,12 @@ namespace luakit {
                         nsize *= 2;
                     }
                     if (nsize > BUFFER_MAX) {
+                        _stat_fail();
                         return nullptr;
                     }
                     space_len = _resize(nsize);
                     if (space_len < len) {
+                        _stat_fail();
                         return nullptr;
                     }
                 }
@@ -148,6 +351,22 @@ namespace luakit {
             return m_tail;
         }
 
+        //导出可读区域，用于writev
+        inline size_t peek_iov(iovec* iov, size_t count) {
+            if (count == 0 || m_tail == m_head) return 0;
+            iov[0].iov_base = m_head;
+            iov[0].iov_len = m_tail - m_head;
+            return 1;
+        }
+
+        //导出至少len字节的可写区域，用于readv，写入后调用pop_space提交
+        inline size_t space_iov(iovec* iov, size_t count, size_t len) {
+            if (count == 0 || !peek_space(len)) return 0;
+            iov[0].iov_base = m_tail;
+            iov[0].iov_len = m_end - m_tail;
+            return 1;
+        }
+
         inline uint8_t* data(size_t* len) {
             *len = (size_t)(m_tail - m_head);
             return m_head;
@@ -158,6 +377,81 @@ namespace luakit {
             return std::string_view((cpchar)m_head, len);
         }
 
+#ifndef WIN32
+        //从fd读取一次数据，读取量参考FIONREAD或最近的读取历史
+        //空闲区不足时多出的部分先读到栈上，避免按猜测值扩容
+        inline int read_from(int fd, size_t* read_len = nullptr) {
+            size_t want = m_read_hint;
+            int avail = 0;
+            if (ioctl(fd, FIONREAD, &avail) == 0 && avail > 0) {
+                want = std::min((size_t)avail, READ_MAX);
+                //已知数据量时直接预留空间
+                peek_space(want);
+            }
+            size_t spare = m_end - m_tail;
+            if (spare < want) {
+                spare = _regularize();
+            }
+            size_t data_len = m_tail - m_head;
+            size_t room = BUFFER_MAX - data_len - spare;
+            if (spare == 0 && room == 0) {
+                errno = ENOBUFS;
+                return io_error;
+            }
+            uint8_t scratch[READ_SCRATCH];
+            iovec iov[2];
+            iov[0].iov_base = m_tail;
+            iov[0].iov_len = spare;
+            iov[1].iov_base = scratch;
+            iov[1].iov_len = std::min(READ_SCRATCH, room);
+            ssize_t n;
+            do {
+                n = readv(fd, spare > 0 ? iov : iov + 1, spare > 0 ? 2 : 1);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? io_again : io_error;
+            }
+            if (n == 0) return io_eof;
+            size_t len = (size_t)n;
+            if (len > spare) {
+                m_tail += spare;
+                //已从fd读出的数据无法退回，放不下时只能按错误处理
+                if (push_data(scratch, len - spare) == 0) {
+                    if (read_len) *read_len = spare;
+                    errno = ENOBUFS;
+                    return io_error;
+                }
+            } else {
+                m_tail += len;
+            }
+            //读满则放大下次读取量，不足一半则缩小
+            if (len >= want) {
+                m_read_hint = std::min(m_read_hint * 2, READ_MAX);
+            } else if (len < m_read_hint / 2) {
+                m_read_hint = std::max(m_read_hint / 2, READ_MIN);
+            }
+            if (read_len) *read_len = len;
+            return io_ok;
+        }
+
+        //把数据写入fd，已写出的部分从buff中移除
+        inline int write_to(int fd, size_t* write_len = nullptr) {
+            size_t data_len = m_tail - m_head;
+            if (write_len) *write_len = 0;
+            if (data_len == 0) return io_ok;
+            ssize_t n;
+            do {
+                n = ::write(fd, m_head, data_len);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? io_again : io_error;
+            }
+            pop_size((size_t)n);
+            if (write_len) *write_len = (size_t)n;
+            return io_ok;
+        }
+#endif
+
         inline size_t write(cpchar src) {
             return push_data((cpbyte)src, strlen(src));
         }
@@ -192,6 +486,56 @@ namespace luakit {
             throw std::length_error("buff read not engugh!");
         }
 
+        //批量写入count个元素，swap为true时翻转字节序
+        template <arithmetic T>
+        inline size_t write_array(const T* src, size_t count, bool swap = false) {
+            size_t len = count * sizeof(T);
+            uint8_t* target = peek_space(len);
+            if (count == 0 || !target) return 0;
+            if (swap) {
+                byteswap_array((T*)target, src, count);
+            } else {
+                memcpy(target, src, len);
+            }
+            m_tail += len;
+            return count;
+        }
+
+        inline size_t write_varint(uint64_t val) {
+            uint8_t* target = peek_space(VARINT_MAX);
+            if (!target) return 0;
+            size_t len = varint_encode(target, val);
+            m_tail += len;
+            return len;
+        }
+
+        inline size_t write_zigzag(int64_t val) {
+            return write_varint(zigzag_encode(val));
+        }
+
+        //批量写入varint，一次预留空间，返回写入字节数
+        inline size_t write_varints(const uint64_t* src, size_t count) {
+            uint8_t* target = peek_space(count * VARINT_MAX);
+            if (count == 0 || !target) return 0;
+            uint8_t* cur = target;
+            for (size_t i = 0; i < count; ++i) {
+                cur += varint_encode(cur, src[i]);
+            }
+            m_tail = cur;
+            return cur - target;
+        }
+
+        inline size_t write_zigzags(const int64_t* src, size_t count) {
+            uint8_t* target = peek_space(count * VARINT_MAX);
+            if (count == 0 || !target) return 0;
+            uint8_t* cur = target;
+            for (size_t i = 0; i < count; ++i) {
+                cur += varint_encode(cur, zigzag_encode(src[i]));
+            }
+            m_tail = cur;
+            return cur - target;
+        }
+
         template <std::integral T, size_t N = sizeof(T)>
         inline size_t swap_write(T val) {
             static_assert(N <= sizeof(T) && N > 0, "invalid byte count N");
@@ -227,8 +571,15 @@ namespace luakit {
                 if (data_len > 0) {
                     memmove(m_data, m_head, data_len);
                 }
+#ifdef LUAKIT_BUFF_STATS
+                m_stats.compacts++;
+                m_stats.moved += data_len;
+                t_buff_stats.compacts++;
+                t_buff_stats.moved += data_len;
+#endif
                 m_tail = m_data + data_len;
                 m_head = m_data;
+                m_slice.expire();
             }
             return m_size - data_len;
         }
@@ -239,20 +590,57 @@ namespace luakit {
             if (m_size == size || size < data_len || size > BUFFER_MAX) {
                 return m_end - m_tail;
             }
-            m_data = (uint8_t*)realloc(m_data, size);
+            uint8_t* data = m_alloc->alloc(size);
+            if (data_len > 0) {
+                memcpy(data, m_head, data_len);
+            }
+#ifdef LUAKIT_BUFF_STATS
+            m_stats.resizes++;
+            m_stats.moved += data_len;
+            t_buff_stats.resizes++;
+            t_buff_stats.moved += data_len;
+#endif
+            _stat_size(size);
+            m_alloc->release(m_data, m_size);
+            m_data = data;
             m_tail = m_data + data_len;
             m_end = m_data + size;
             m_head = m_data;
             m_size = size;
+            m_slice.expire();
             return size - data_len;
         }
 
         void _alloc() {
-            m_data = (uint8_t*)malloc(BUFFER_DEF);
+            m_data = m_alloc->alloc(BUFFER_DEF);
             m_size = BUFFER_DEF;
             m_head = m_tail = m_data;
             m_end = m_data + BUFFER_DEF;
             m_max = m_size * ALIGN_SIZE;
+            _stat_size(BUFFER_DEF);
+        }
+
+        //容量变化：更新峰值和BUFFER_MAX时长
+        void _stat_size([[maybe_unused]] size_t size) {
+#ifdef LUAKIT_BUFF_STATS
+            if (m_max_since > 0 && size != BUFFER_MAX) {
+                uint64_t time = steady_ns() - m_max_since;
+                m_stats.max_time += time;
+                t_buff_stats.max_time += time;
+                m_max_since = 0;
+            } else if (m_max_since == 0 && size == BUFFER_MAX) {
+                m_max_since = steady_ns();
+            }
+            m_stats.peak = std::max(m_stats.peak, size);
+            t_buff_stats.peak = std::max(t_buff_stats.peak, size);
+#endif
+        }
+
+        void _stat_fail() {
+#ifdef LUAKIT_BUFF_STATS
+            m_stats.space_fails++;
+            t_buff_stats.space_fails++;
+#endif
         }
 
     private:
@@ -262,6 +650,43 @@ namespace luakit {
         uint8_t* m_tail;
         uint8_t* m_end;
         uint8_t* m_data;
+        buff_alloc* m_alloc;
         slice m_slice;
+#ifdef LUAKIT_BUFF_STATS
+        buff_stats m_stats;
+        uint64_t m_max_since = 0;
+#endif
+        size_t m_read_hint = READ_MIN * 4;
     };
+
+    //按顺序导出多个buff/slice的可读区域，返回iovec数量
+    inline size_t gather_iov(iovec*, size_t) {
+        return 0;
+    }
+
+    template <typename T, typename... Bufs>
+    size_t gather_iov(iovec* iov, size_t count, T* buf, Bufs*... bufs) {
+        size_t n = buf->peek_iov(iov, count);
+        return n + gather_iov(iov + n, count - n, bufs...);
+    }
+
+    //writev完成后按顺序消费已发送的字节，返回剩余未消费的长度
+    inline size_t consume_iov(size_t len) {
+        return len;
+    }
+
+    template <typename... Bufs>
+    size_t consume_iov(size_t len, slice* buf, Bufs*... bufs) {
+        size_t n = std::min(len, buf->size());
+        buf->erase(n);
+        return consume_iov(len - n, bufs...);
+    }
+
+    //slice及其子类(如mapped_slice)使用上面的erase版本
+    template <typename T, typename... Bufs> requires (!std::is_base_of_v<slice, T>)
+    size_t consume_iov(size_t len, T* buf, Bufs*... bufs) {
+        size_t n = std::min(len, buf->size());
+        buf->pop_size(n);
+        return consume_iov(len - n, bufs...);
+    }
 }
@@ -0,0 +1,388 @@
+#pragma once
+
+#include "lua_buff.h"
+
+namespace luakit {
+
+    const size_t BLOCK_SIZE = 16 * 1024;    //16K
+    const size_t BLOCK_CACHE = 256;         //池中缓存块上限(4M)
+
+    //链式缓冲块，数据紧跟在块头之后
+    struct buff_block {
+        buff_block* next = nullptr;
+        uint8_t* head = nullptr;
+        uint8_t* tail = nullptr;
+        uint8_t* end = nullptr;
+
+        inline uint8_t* base() {
+            return (uint8_t*)(this + 1);
+        }
+
+        inline size_t size() {
+            return tail - head;
+        }
+
+        inline size_t space() {
+            return end - tail;
+        }
+
+        inline size_t capacity() {
+            return end - base();
+        }
+    };
+
+    //固定大小块的缓存池，超大块直接释放
+    class block_pool {
+    public:
+        ~block_pool() {
+            while (m_free) {
+                buff_block* block = m_free;
+                m_free = block->next;
+                free(block);
+            }
+        }
+
+        buff_block* alloc(size_t size) {
+            buff_block* block = nullptr;
+            if (size <= BLOCK_SIZE && m_free) {
+                block = m_free;
+                m_free = block->next;
+                m_count--;
+            } else {
+                size_t cap = std::max(size, BLOCK_SIZE);
+                block = (buff_block*)malloc(sizeof(buff_block) + cap);
+                if (!block) return nullptr;
+                block->end = block->base() + cap;
+            }
+            block->next = nullptr;
+            block->head = block->tail = block->base();
+            return block;
+        }
+
+        void release(buff_block* block) {
+            if (block->capacity() == BLOCK_SIZE && m_count < BLOCK_CACHE) {
+                block->next = m_free;
+                m_free = block;
+                m_count++;
+                return;
+            }
+            free(block);
+        }
+
+        size_t count() {
+            return m_count;
+        }
+
+    private:
+        size_t m_count = 0;
+        buff_block* m_free = nullptr;
+    };
+
+    inline thread_local block_pool t_blocks;
+
+    //链式缓冲区：追加不移动已有数据，消费完的块归还缓存池
+    //需要连续内存时(peek_data/get_slice/data)才合并跨块区域
+    //与luabuf的push_data/peek_data/pop_size/get_slice用法一致，用作收发队列；编解码仍写入luabuf
+    class chain_buf {
+    public:
+        chain_buf() {}
+        ~chain_buf() { reset(); }
+        chain_buf(const chain_buf&) = delete;
+        chain_buf& operator =(const chain_buf&) = delete;
+
+        inline void reset() {
+            while (m_first) {
+                buff_block* block = m_first;
+                m_first = block->next;
+                t_blocks.release(block);
+            }
+            m_last = m_fill = nullptr;
+            m_size = 0;
+            m_slice.expire();
+        }
+
+        inline void clean() {
+            reset();
+        }
+
+        inline size_t size() {
+            return m_size;
+        }
+
+        inline size_t empty() {
+            return m_size == 0;
+        }
+
+        inline size_t block_count() {
+            size_t count = 0;
+            for (buff_block* block = m_first; block; block = block->next) {
+                count++;
+            }
+            return count;
+        }
+
+        inline size_t push_data(cpbyte src, size_t push_len) {
+            size_t left = push_len;
+            m_fill = nullptr;
+            while (left > 0) {
+                if (!m_last || m_last->space() == 0) {
+                    if (!_append(BLOCK_SIZE)) return 0;
+                }
+                size_t len = std::min(left, m_last->space());
+                memcpy(m_last->tail, src, len);
+                m_last->tail += len;
+                m_size += len;
+                src += len;
+                left -= len;
+            }
+            return push_len;
+        }
+
+        inline size_t pop_data(uint8_t* dest, size_t pop_len) {
+            if (pop_len == 0 || m_size < pop_len) return 0;
+            size_t left = pop_len;
+            while (left > 0) {
+                size_t len = std::min(left, m_first->size());
+                memcpy(dest, m_first->head, len);
+                dest += len;
+                left -= len;
+                _consume(len);
+            }
+            return pop_len;
+        }
+
+        inline size_t pop_size(size_t erase_len) {
+            if (m_size < erase_len) return 0;
+            size_t left = erase_len;
+            while (left > 0) {
+                size_t len = std::min(left, m_first->size());
+                left -= len;
+                _consume(len);
+            }
+            return erase_len;
+        }
+
+        inline uint8_t* peek_data(size_t peek_len, size_t offset = 0) {
+            if (peek_len == 0 || offset > m_size || m_size - offset < peek_len) {
+                return nullptr;
+            }
+            return _linearize(offset, peek_len);
+        }
+
+        inline uint8_t* peek_space(size_t len) {
+            if (!m_last || m_last->space() < len) {
+                if (!_append(len)) return nullptr;
+            }
+            m_fill = m_last;
+            return m_last->tail;
+        }
+
+        //从peek_space/space_iov预留的位置开始提交，可以跨块
+        inline size_t pop_space(size_t space_len) {
+            buff_block* block = m_fill ? m_fill : m_last;
+            size_t space = 0;
+            for (buff_block* cur = block; cur && space < space_len; cur = cur->next) {
+                space += cur->space();
+            }
+            if (space < space_len) return 0;
+            size_t left = space_len;
+            while (left > 0) {
+                size_t len = std::min(left, block->space());
+                block->tail += len;
+                left -= len;
+                if (left > 0) block = block->next;
+            }
+            m_fill = block;
+            m_size += space_len;
+            return space_len;
+        }
+
+        //导出可读区域，用于writev
+        inline size_t peek_iov(iovec* iov, size_t count) {
+            size_t n = 0;
+            for (buff_block* block = m_first; block && n < count; block = block->next) {
+                if (block->size() == 0) continue;
+                iov[n].iov_base = block->head;
+                iov[n].iov_len = block->size();
+                n++;
+            }
+            return n;
+        }
+
+        //导出至少len字节的可写区域，不足时追加新块，用于readv，写入后调用pop_space提交
+        inline size_t space_iov(iovec* iov, size_t count, size_t len) {
+            if (count == 0) return 0;
+            if (!m_last || m_last->space() == 0) {
+                if (!_append(BLOCK_SIZE)) return 0;
+            }
+            size_t n = 0, space = 0;
+            buff_block* block = m_last;
+            m_fill = block;
+            while (true) {
+                iov[n].iov_base = block->tail;
+                iov[n].iov_len = block->space();
+                space += block->space();
+                if (++n >= count || space >= len) break;
+                if (!_append(BLOCK_SIZE)) break;
+                block = m_last;
+            }
+            return n;
+        }
+
+        inline slice* get_slice(size_t len = 0, uint32_t offset = 0) {
+            if (offset > m_size) offset = m_size;
+            if (len == 0) len = m_size - offset;
+            uint8_t* data = peek_data(len, offset);
+            m_slice.attach(data, data ? len : 0);
+            return &m_slice;
+        }
+
+        inline uint8_t* data(size_t* len) {
+            *len = m_size;
+            if (m_size == 0) {
+                return m_first ? m_first->head : nullptr;
+            }
+            return _linearize(0, m_size);
+        }
+
+        inline vstring string() {
+            size_t len = 0;
+            cpchar data = (cpchar)this->data(&len);
+            return vstring(data, len);
+        }
+
+        inline size_t write(cpchar src) {
+            return push_data((cpbyte)src, strlen(src));
+        }
+
+        inline size_t write(cstring& src) {
+            return push_data((cpbyte)src.c_str(), src.size());
+        }
+
+        inline size_t write(cvstring src) {
+            return push_data((cpbyte)src.data(), src.size());
+        }
+
+        template <arithmetic T, size_t N = sizeof(T)>
+        inline size_t write(T val) {
+            return push_data((cpbyte)&val, N);
+        }
+
+        template <arithmetic T = uint8_t, size_t N = sizeof(T)>
+        inline T read() {
+            T val;
+            if (pop_data((uint8_t*)&val, N) == 0) {
+                throw std::length_error("chain read not engugh!");
+            }
+            return val;
+        }
+
+        template <std::integral T, size_t N = sizeof(T)>
+        inline size_t swap_write(T val) {
+            static_assert(N <= sizeof(T) && N > 0, "invalid byte count N");
+            val = byteswap(val);
+            return push_data(reinterpret_cast<uint8_t*>(&val) + sizeof(T) - N, N);
+        }
+
+        template <std::integral T, size_t N = sizeof(T)>
+        inline T swap_read() {
+            static_assert(N <= sizeof(T) && N > 0, "invalid byte count N");
+            T val = 0;
+            if (pop_data(reinterpret_cast<uint8_t*>(&val) + sizeof(T) - N, N) == 0) {
+                throw std::length_error("chain read not engugh!");
+            }
+            return byteswap(val);
+        }
+
+    protected:
+        //追加新块
+        buff_block* _append(size_t len) {
+            buff_block* block = t_blocks.alloc(len);
+            if (!block) return nullptr;
+            if (m_last) {
+                m_last->next = block;
+            } else {
+                m_first = block;
+            }
+            m_last = block;
+            return block;
+        }
+
+        //消费首块数据，读空的块归还缓存池
+        void _consume(size_t len) {
+            m_first->head += len;
+            m_size -= len;
+            if (m_first->head == m_first->tail) {
+                if (m_first == m_last) {
+                    m_first->head = m_first->tail = m_first->base();
+                    return;
+                }
+                buff_block* block = m_first;
+                m_first = block->next;
+                if (block == m_fill) m_fill = nullptr;
+                t_blocks.release(block);
+                m_slice.expire();
+            }
+        }
+
+        //把[offset, offset + len)合并到一个连续块中，原链顺序保持不变
+        uint8_t* _linearize(size_t offset, size_t len) {
+            buff_block* prev = nullptr;
+            buff_block* block = m_first;
+            while (offset >= block->size()) {
+                offset -= block->size();
+                prev = block;
+                block = block->next;
+            }
+            if (block->size() - offset >= len) {
+                return block->head + offset;
+            }
+            buff_block* merged = t_blocks.alloc(len);
+            if (!merged) return nullptr;
+            m_fill = nullptr;
+            m_slice.expire();
+            //拆分起始块：保留offset之前的数据
+            size_t left = len;
+            size_t first_len = block->size() - offset;
+            memcpy(merged->tail, block->head + offset, first_len);
+            merged->tail += first_len;
+            left -= first_len;
+            block->tail = block->head + offset;
+            buff_block* cur = block->next;
+            while (left > 0) {
+                size_t copy_len = std::min(left, cur->size());
+                memcpy(merged->tail, cur->head, copy_len);
+                merged->tail += copy_len;
+                left -= copy_len;
+                cur->head += copy_len;
+                if (cur->head == cur->tail && cur != m_last) {
+                    buff_block* next = cur->next;
+                    t_blocks.release(cur);
+                    cur = next;
+                }
+            }
+            //合并块接在起始块之后，起始块空了则替换掉
+            if (cur->head == cur->tail && cur == m_last) {
+                t_blocks.release(cur);
+                merged->next = nullptr;
+                m_last = merged;
+            } else {
+                merged->next = cur;
+            }
+            if (offset == 0) {
+                if (prev) prev->next = merged; else m_first = merged;
+                t_blocks.release(block);
+            } else {
+                block->next = merged;
+            }
+            return merged->head;
+        }
+
+    private:
+        size_t m_size = 0;
+        buff_block* m_first = nullptr;
+        buff_block* m_last = nullptr;
+        buff_block* m_fill = nullptr;
+        slice m_slice;
+    };
+}
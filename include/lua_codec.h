@@ -4,9 +4,20 @@
 #pragma warning(disable: 4267)
 #endif
 
+#include <array>
+#include <cmath>
+#include <charconv>
+
+#include "lua_lz.h"
+#include "lua_crc.h"
 #include "lua_buff.h"
+#include "lua_ring.h"
 #include "lua_extend.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace luakit {
     const uint8_t type_nil          = 0;
     const uint8_t type_true         = 1;
@@ -25,14 +36,241 @@ namespace luakit {
     const uint8_t type_undefine     = 14;
     const uint8_t type_max          = 15;
 
+    //扩展类型：值位置的type_tab_tail后跟1字节子类型，原有类型和内联整数的编码保持不变
+    //键位置的type_tab_tail仍表示表结束，所以表作为键时总是按type_tab_head编码
+    const uint8_t type_ext          = type_tab_tail;
+    const uint8_t ext_array         = 0;    //varint个数 + 值
+    const uint8_t ext_map           = 1;    //容量指数(2^n) + 键值对 + tab_tail
+    const uint8_t ext_record        = 2;    //varint结构id + 按字段顺序的值
+    const uint8_t ext_tabdef        = 3;    //引用模式：首次出现的表，按出现顺序编号
+    const uint8_t ext_tabref        = 4;    //引用模式：varint表序号
+
+    const uint8_t max_size_hint     = 24;   //map容量指数上限
+
     const uint8_t max_encode_depth  = 16;
     const uint8_t max_share_string  = 128;
     const uint8_t max_uint8         = UCHAR_MAX - type_max;
     const uint32_t max_string_size  = 0xffffff;
 
+    const size_t share_slots        = 256;  //键索引哈希槽数，max_share_string的2倍
+
+    //编码时的键索引，替代对t_sshares的线性查找
+    //按内容哈希和比较：C++侧的键不经过lua驻留，指针相同不代表内容相同
+    class share_index {
+    public:
+        void clear() {
+            m_count = 0;
+            if (++m_gen == 0) {
+                for (auto& slot : m_slots) slot.gen = 0;
+                m_gen = 1;
+            }
+        }
+
+        //返回已有索引；不存在时返回-1，字典未满则加入并置inserted
+        int find_or_insert(cpchar ptr, size_t sz, bool& inserted) {
+            size_t hash = _hash(ptr, sz);
+            size_t pos = hash & (share_slots - 1);
+            while (true) {
+                share_slot& slot = m_slots[pos];
+                if (slot.gen != m_gen) {
+                    if (m_count < max_share_string) {
+                        slot = { ptr, hash, m_gen, (uint16_t)sz, (uint8_t)m_count++ };
+                        inserted = true;
+                    }
+                    return -1;
+                }
+                if (slot.hash == hash && slot.len == sz && memcmp(slot.ptr, ptr, sz) == 0) {
+                    return slot.index;
+                }
+                pos = (pos + 1) & (share_slots - 1);
+            }
+        }
+
+    protected:
+        size_t _hash(cpchar ptr, size_t sz) {
+            return std::hash<vstring>()(vstring(ptr, sz));
+        }
+
+    private:
+        struct share_slot {
+            cpchar ptr;
+            size_t hash;
+            uint32_t gen;
+            uint16_t len;
+            uint8_t index;
+        };
+        size_t m_count = 0;
+        uint32_t m_gen = 1;
+        share_slot m_slots[share_slots] = {};
+    };
+
+    const size_t max_session_slots  = 256;  //会话字典槽位上限，槽号为uint8
+
+    //会话字典：由codec持有，跨消息保留键名，双方需同时开启
+    //会话模式下 type_istring: slot + len + bytes 定义槽位(覆盖旧值即淘汰)
+    //          type_strindex: slot 引用槽位
+    //淘汰由编码端决定并写入定义消息，解码端只需按顺序重放
+    //编解码失败时，未提交的修改在下一次begin时回滚
+    class session_dict {
+    public:
+        session_dict(size_t slots = max_session_slots) {
+            m_capacity = std::clamp<size_t>(slots, 1, max_session_slots);
+            m_send.resize(m_capacity);
+            m_recv.resize(m_capacity);
+        }
+
+        void begin() {
+            rollback();
+        }
+
+        void commit() {
+            m_send_log.clear();
+            m_recv_log.clear();
+        }
+
+        void rollback() {
+            for (auto it = m_send_log.rbegin(); it != m_send_log.rend(); ++it) {
+                send_slot& slot = m_send[it->slot];
+                if (slot.used) m_index.erase(slot.key);
+                slot.key = std::move(it->key);
+                slot.used = it->used;
+                if (slot.used) m_index[slot.key] = it->slot;
+            }
+            for (auto it = m_recv_log.rbegin(); it != m_recv_log.rend(); ++it) {
+                m_recv[it->slot] = std::move(it->key);
+            }
+            commit();
+        }
+
+        //编码端：返回键所在槽位，新定义时置defined
+        uint8_t find_or_define(cpchar ptr, size_t sz, bool& defined) {
+            auto it = m_index.find(vstring(ptr, sz));
+            if (it != m_index.end()) {
+                m_send[it->second].ref = true;
+                m_hits++;
+                return it->second;
+            }
+            uint8_t pos = _evict();
+            send_slot& slot = m_send[pos];
+            if (slot.used) {
+                //索引键指向槽位内存，需先删除
+                m_index.erase(slot.key);
+                m_evicts++;
+            }
+            m_send_log.push_back({ pos, slot.used, std::move(slot.key) });
+            slot.key.assign(ptr, sz);
+            slot.used = true;
+            slot.ref = false;
+            m_index[slot.key] = pos;
+            m_defines++;
+            defined = true;
+            return pos;
+        }
+
+        //解码端：重放定义
+        void define(uint8_t pos, cpchar ptr, size_t sz) {
+            if (pos >= m_capacity) {
+                throw lua_exception("decode session slot {} is out of range", pos);
+            }
+            m_recv_log.push_back({ pos, true, std::move(m_recv[pos]) });
+            m_recv[pos].assign(ptr, sz);
+        }
+
+        vstring find(uint8_t pos) {
+            if (pos >= m_capacity || m_recv[pos].empty()) {
+                throw lua_exception("decode session slot {} is undefined", pos);
+            }
+            return m_recv[pos];
+        }
+
+        size_t capacity() { return m_capacity; }
+        size_t hits() { return m_hits; }
+        size_t defines() { return m_defines; }
+        size_t evicts() { return m_evicts; }
+
+    protected:
+        //时钟算法选择淘汰槽位，优先使用空槽
+        uint8_t _evict() {
+            while (true) {
+                uint8_t pos = (uint8_t)m_hand;
+                m_hand = (m_hand + 1) % m_capacity;
+                send_slot& slot = m_send[pos];
+                if (!slot.used || !slot.ref) return pos;
+                slot.ref = false;
+            }
+        }
+
+    private:
+        struct send_slot {
+            std::string key;
+            bool used = false;
+            bool ref = false;
+        };
+        struct undo_log {
+            uint8_t slot;
+            bool used;
+            std::string key;
+        };
+        size_t m_hand = 0;
+        size_t m_hits = 0;
+        size_t m_evicts = 0;
+        size_t m_defines = 0;
+        size_t m_capacity = 0;
+        std::vector<send_slot> m_send;
+        std::vector<std::string> m_recv;
+        std::vector<undo_log> m_send_log;
+        std::vector<undo_log> m_recv_log;
+        std::unordered_map<vstring, uint8_t> m_index;
+    };
+
+    inline thread_local share_index t_sindex;
+    inline thread_local session_dict* t_session = nullptr;
+
+    //一次编解码期间的会话字典：构造时设置t_session并开始记录，析构时清空
+    //lua错误走longjmp时不会析构，所以每个入口都要构造它，不能依赖上一次调用的清理
+    class session_scope {
+    public:
+        session_scope(session_dict* session) {
+            t_session = session;
+            if (session) session->begin();
+        }
+        ~session_scope() {
+            t_session = nullptr;
+        }
+        void commit() {
+            if (t_session) t_session->commit();
+        }
+    };
     inline thread_local std::vector<vstring> t_sshares(max_share_string);
 
+    //引用模式：编码时记录已编码的表，解码时登记到注册表的tabref_registry中
+    inline const char tabref_registry = 0;
+    inline thread_local bool t_tabref = false;
+    inline thread_local std::unordered_map<const void*, uint32_t> t_tabrefs;
+    inline thread_local bool t_tabdef = false;
+    inline thread_local uint32_t t_tabdefs = 0;
+
+    //一次解码期间的引用模式状态：析构时释放tabref_registry中登记的表，解码出错时也不会残留
+    class tabref_scope {
+    public:
+        tabref_scope(lua_State* L) : m_L(L) {
+            t_tabdef = false;
+            t_tabdefs = 0;
+        }
+        ~tabref_scope() {
+            if (t_tabdefs > 0 && lua_checkstack(m_L, 1)) {
+                lua_pushnil(m_L);
+                lua_rawsetp(m_L, LUA_REGISTRYINDEX, &tabref_registry);
+            }
+            t_tabdef = false;
+            t_tabdefs = 0;
+        }
+    private:
+        lua_State* m_L;
+    };
+
     int decode_one(lua_State* L, slice* slice);
+    void decode_value(lua_State* L, slice* slice, uint8_t type);
     void encode_one(lua_State* L, luabuf* buff, int idx, size_t depth, bool isindex = false);
     void serialize_one(lua_State* L, luabuf* buff, int index, size_t depth, size_t line);
 
@@ -45,13 +283,6 @@ namespace luakit {
         buff->push_data((cpbyte)data, len);
     }
 
-    inline int8_t find_index(vstring& str) {
-        for (int i = 0; i < t_sshares.size(); ++i) {
-            if (t_sshares[i] == str) return i;
-        }
-        return -1;
-    }
-
     inline vstring find_string(size_t index) {
         return (index < t_sshares.size()) ? t_sshares[index] : "";
     }
@@ -82,26 +313,30 @@ namespace luakit {
         string_write(buff, ptr, sz);
     }
 
-    inline void index_encode(lua_State* L, luabuf* buff, int index) {
-        size_t sz = 0;
-        cpchar ptr = lua_tolstring(L, index, &sz);
-        if (sz > USHRT_MAX) {
-            luaL_error(L, "encode index can't pack too long (%d) string", sz);
-            return;
-        }
+    //写入表的字符串键，ptr在整条消息编码期间需保持有效
+    inline void index_write(luabuf* buff, cpchar ptr, size_t sz) {
         if (sz > UCHAR_MAX || sz == 0) {
             string_write(buff, ptr, sz);
             return;
         }
-        vstring value(ptr, sz);
-        int8_t sindex = find_index(value);
-        if (sindex < 0){
-            if (t_sshares.size() < max_share_string) {
+        if (t_session) {
+            bool defined = false;
+            uint8_t slot = t_session->find_or_define(ptr, sz, defined);
+            if (defined) {
                 value_encode(buff, type_istring);
-                t_sshares.push_back(value);
-            } else {
-                value_encode(buff, type_string8);
+                value_encode<uint8_t>(buff, slot);
+                value_encode<uint8_t>(buff, sz);
+                value_encode(buff, ptr, sz);
+                return;
             }
+            value_encode(buff, type_strindex);
+            value_encode<uint8_t>(buff, slot);
+            return;
+        }
+        bool inserted = false;
+        int sindex = t_sindex.find_or_insert(ptr, sz, inserted);
+        if (sindex < 0){
+            value_encode(buff, inserted ? type_istring : type_string8);
             value_encode<uint8_t>(buff, sz);
             value_encode(buff, ptr, sz);
             return;
@@ -110,6 +345,25 @@ namespace luakit {
         value_encode<uint8_t>(buff, sindex);
     }
 
+    inline void index_encode(lua_State* L, luabuf* buff, int index) {
+        size_t sz = 0;
+        cpchar ptr = lua_tolstring(L, index, &sz);
+        if (sz > USHRT_MAX) {
+            luaL_error(L, "encode index can't pack too long (%d) string", sz);
+            return;
+        }
+        index_write(buff, ptr, sz);
+    }
+
+    //map容量指数
+    constexpr uint8_t size_hint(size_t count) {
+        uint8_t exp = 0;
+        while (exp < max_size_hint && ((size_t)1 << exp) < count) {
+            exp++;
+        }
+        return exp;
+    }
+
     inline void integer_encode(luabuf* buff, int64_t integer) {
         if (integer >= 0 && integer <= max_uint8) {
             integer += type_max;
@@ -135,7 +389,233 @@ namespace luakit {
         value_encode(buff, number);
     }
 
+    //扩展子类型是否为表，引用模式的定义前缀之后只能是表
+    inline bool ext_table(uint8_t ext) {
+        return ext == ext_array || ext == ext_map || ext == ext_record;
+    }
+
+    inline void ext_encode(luabuf* buff, uint8_t ext) {
+        value_encode(buff, type_ext);
+        value_encode(buff, ext);
+    }
+
+    //结构注册表的registry键，每个lua_State一份
+    inline const char schema_registry = 0;
+    const int schema_integer = 100;     //结构字段类型integer
+    inline thread_local uint32_t t_schema_version = 0;  //结构注册次数，线程外解码据此更新结构快照
+
+    //结构字段数快照：结构id -> 字段数，在注册结构的lua线程生成，其它线程只读
+    using schema_fields = std::unordered_map<uint32_t, uint32_t>;
+    using schema_snapshot_ptr = std::shared_ptr<const schema_fields>;
+
+    //原生解码期间使用的快照，由codec在解码时设置
+    inline thread_local const schema_fields* t_schemas = nullptr;
+
+    class schema_scope {
+    public:
+        schema_scope(const schema_fields* schemas) : m_prev(t_schemas) {
+            t_schemas = schemas;
+        }
+        ~schema_scope() {
+            t_schemas = m_prev;
+        }
+    private:
+        const schema_fields* m_prev;
+    };
+
+    inline void push_schema_registry(lua_State* L) {
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, &schema_registry) != LUA_TTABLE) {
+            lua_pop(L, 1);
+            lua_createtable(L, 8, 0);
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, &schema_registry);
+        }
+    }
+
+    //生成当前已注册结构的快照
+    inline schema_snapshot_ptr schema_snapshot(lua_State* L) {
+        auto schemas = std::make_shared<schema_fields>();
+        push_schema_registry(L);
+        lua_pushnil(L);
+        while (lua_next(L, -2)) {
+            if (lua_isinteger(L, -2) && lua_istable(L, -1)) {
+                if (lua_rawgetp(L, -1, &schema_registry) == LUA_TTABLE) {
+                    (*schemas)[(uint32_t)lua_tointeger(L, -3)] = (uint32_t)lua_rawlen(L, -1);
+                }
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+        return schemas;
+    }
+
+    //注册结构：fields为有序字段名数组，types为可选的对应类型名(lua类型名或integer)
+    //返回的元表带有__schema/__fields/__types，设置了该元表的表按结构编码
+    //表中有结构之外的字段时按普通表编码，两端需注册相同的结构
+    //元表中以&schema_registry为键保存编解码用的信息表：[0]=id，[-1]=types，[1..n]=字段名
+    inline int schema_register(lua_State* L, lua_Integer id, int fields, int types) {
+        fields = lua_absindex(L, fields);
+        types = types ? lua_absindex(L, types) : 0;
+        if (id <= 0 || id > UINT32_MAX) {
+            luaL_error(L, "schema id %d is out of range", (int)id);
+        }
+        size_t count = lua_rawlen(L, fields);
+        lua_createtable(L, 0, 4);
+        lua_pushinteger(L, id);
+        lua_setfield(L, -2, "__schema");
+        lua_createtable(L, (int)count, 2);
+        lua_pushinteger(L, id);
+        lua_rawseti(L, -2, 0);
+        for (size_t i = 1; i <= count; ++i) {
+            if (lua_rawgeti(L, fields, i) != LUA_TSTRING) {
+                luaL_error(L, "schema field %d must be string", (int)i);
+            }
+            lua_rawseti(L, -2, i);
+        }
+        lua_pushvalue(L, fields);
+        lua_setfield(L, -3, "__fields");
+        if (types && lua_istable(L, types)) {
+            //类型名预先转换为lua类型值，integer单独处理
+            lua_createtable(L, (int)count, 0);
+            for (size_t i = 1; i <= count; ++i) {
+                if (lua_rawgeti(L, types, i) != LUA_TSTRING) {
+                    lua_pop(L, 1);
+                    continue;
+                }
+                cpchar name = lua_tostring(L, -1);
+                int type = schema_integer;
+                if (strcmp(name, "integer") != 0) {
+                    for (type = LUA_TNIL; type < LUA_NUMTYPES; ++type) {
+                        if (strcmp(name, lua_typename(L, type)) == 0) break;
+                    }
+                    if (type == LUA_NUMTYPES) {
+                        luaL_error(L, "schema field %d has unknown type %s", (int)i, name);
+                    }
+                }
+                lua_pop(L, 1);
+                lua_pushinteger(L, type);
+                lua_rawseti(L, -2, i);
+            }
+            lua_rawseti(L, -2, -1);
+            lua_pushvalue(L, types);
+            lua_setfield(L, -3, "__types");
+        }
+        lua_rawsetp(L, -2, &schema_registry);
+        push_schema_registry(L);
+        lua_pushvalue(L, -2);
+        lua_rawseti(L, -2, id);
+        lua_pop(L, 1);
+        t_schema_version++;
+        return 1;
+    }
+
+    //lua: schema(id, fields, types)
+    inline int lua_new_schema(lua_State* L) {
+        lua_Integer id = luaL_checkinteger(L, 1);
+        luaL_checktype(L, 2, LUA_TTABLE);
+        return schema_register(L, id, 2, lua_istable(L, 3) ? 3 : 0);
+    }
+
+    inline bool schema_check(lua_State* L, int types, size_t i) {
+        if (lua_rawgeti(L, types, i) != LUA_TNUMBER) {
+            lua_pop(L, 1);
+            return true;
+        }
+        int expect = (int)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        return expect == schema_integer ? lua_isinteger(L, -1) : expect == lua_type(L, -1);
+    }
+
+    //带结构元表的表按结构编码，返回false表示普通表
+    inline bool record_encode(lua_State* L, luabuf* buff, int index, size_t depth) {
+        if (!lua_getmetatable(L, index)) return false;
+        int top = lua_gettop(L);
+        if (lua_rawgetp(L, top, &schema_registry) != LUA_TTABLE) {
+            lua_settop(L, top - 1);
+            return false;
+        }
+        int info = top + 1, types = top + 2;
+        lua_rawgeti(L, info, 0);
+        lua_Integer id = lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        bool typed = lua_rawgeti(L, info, -1) == LUA_TTABLE;
+        size_t count = lua_rawlen(L, info);
+        //有结构之外的字段时按普通表编码，避免丢弃数据
+        size_t fields = 0, keys = 0;
+        for (size_t i = 1; i <= count; ++i) {
+            lua_rawgeti(L, info, i);
+            if (lua_rawget(L, index) != LUA_TNIL) fields++;
+            lua_pop(L, 1);
+        }
+        lua_pushnil(L);
+        while (lua_next(L, index) != 0) {
+            lua_pop(L, 1);
+            keys++;
+        }
+        if (keys != fields) {
+            lua_settop(L, top - 1);
+            return false;
+        }
+        ext_encode(buff, ext_record);
+        buff->write_varint(id);
+        for (size_t i = 1; i <= count; ++i) {
+            lua_rawgeti(L, info, i);
+            lua_rawget(L, index);
+            if (typed && !lua_isnil(L, -1) && !schema_check(L, types, i)) {
+                lua_rawgeti(L, info, i);
+                luaL_error(L, "encode schema %d field %s type mismatch", (int)id, lua_tostring(L, -1));
+            }
+            encode_one(L, buff, -1, depth);
+            lua_pop(L, 1);
+        }
+        lua_settop(L, top - 1);
+        return true;
+    }
+
+    inline void array_encode(lua_State* L, luabuf* buff, int index, size_t depth, size_t count) {
+        ext_encode(buff, ext_array);
+        buff->write_varint(count);
+        for (size_t i = 1; i <= count; ++i) {
+            lua_rawgeti(L, index, i);
+            encode_one(L, buff, -1, depth);
+            lua_pop(L, 1);
+        }
+    }
+
     inline void table_encode(lua_State* L, luabuf* buff, int index, size_t depth) {
+        index = lua_absindex(L, index);
+        if (record_encode(L, buff, index, depth)) {
+            return;
+        }
+        size_t raw_len = lua_rawlen(L, index);
+        if (raw_len > 0 && is_lua_array(L, index)) {
+            array_encode(L, buff, index, depth, raw_len);
+            return;
+        }
+        lua_pushnil(L);
+        if (lua_next(L, index) == 0) {
+            array_encode(L, buff, index, depth, 0);
+            return;
+        }
+        //容量指数在遍历后回填
+        ext_encode(buff, ext_map);
+        size_t hint = buff->size();
+        value_encode<uint8_t>(buff, 0);
+        size_t count = 0;
+        do {
+            encode_one(L, buff, -2, depth, true);
+            encode_one(L, buff, -1, depth);
+            lua_pop(L, 1);
+            count++;
+        } while (lua_next(L, index) != 0);
+        uint8_t exp = size_hint(count);
+        buff->copy(hint, &exp, sizeof(uint8_t));
+        value_encode(buff, type_tab_tail);
+    }
+
+    //表作为键时按type_tab_head编码，不使用扩展类型，引用模式下也不登记
+    inline void key_table_encode(lua_State* L, luabuf* buff, int index, size_t depth) {
         index = lua_absindex(L, index);
         value_encode(buff, type_tab_head);
         lua_pushnil(L);
@@ -147,6 +627,18 @@ namespace luakit {
         value_encode(buff, type_tab_tail);
     }
 
+    //首次出现的表加ext_tabdef前缀，再次出现(共享或者成环)时只写序号
+    inline void tabref_encode(lua_State* L, luabuf* buff, int index, size_t depth) {
+        auto [it, inserted] = t_tabrefs.try_emplace(lua_topointer(L, index), (uint32_t)t_tabrefs.size());
+        if (!inserted) {
+            ext_encode(buff, ext_tabref);
+            buff->write_varint(it->second);
+            return;
+        }
+        ext_encode(buff, ext_tabdef);
+        table_encode(L, buff, index, depth);
+    }
+
     inline void encode_one(lua_State* L, luabuf* buff, int idx, size_t depth, bool isindex) {
         if (depth > max_encode_depth) {
             luaL_error(L, "encode can't pack too depth table");
@@ -160,7 +652,11 @@ namespace luakit {
             isindex ? index_encode(L, buff, idx) : string_encode(L, buff, idx);
             break;
         case LUA_TTABLE:
-            table_encode(L, buff, idx, depth + 1);
+            if (isindex) {
+                key_table_encode(L, buff, idx, depth + 1);
+            } else {
+                t_tabref ? tabref_encode(L, buff, idx, depth + 1) : table_encode(L, buff, idx, depth + 1);
+            }
             break;
         case LUA_TBOOLEAN:
             lua_toboolean(L, idx) ? value_encode(buff, type_true) : value_encode(buff, type_false);
@@ -174,22 +670,33 @@ namespace luakit {
         }
     }
 
-    inline slice* encode_slice(lua_State* L, luabuf* buff, int index, int num) {
+    //追加编码一条消息，不清空缓冲区
+    //session非空时使用会话字典，refs开启引用模式，每次调用都会重设t_session/t_tabref
+    inline void encode_append(lua_State* L, luabuf* buff, int index, int num, session_dict* session = nullptr, bool refs = false) {
+        session_scope scope(session);
+        t_tabref = refs;
         if (num > UCHAR_MAX || num < 0) {
             luaL_error(L, "encode can't pack too many args");
         }
-        buff->clean();
-        t_sshares.clear();
+        t_sindex.clear();
+        if (refs) t_tabrefs.clear();
         buff->write<uint8_t>(num);
         for (int i = 0; i < num; i++) {
             encode_one(L, buff, index + i, 0);
         }
+        scope.commit();
+        t_tabref = false;
+    }
+
+    inline slice* encode_slice(lua_State* L, luabuf* buff, int index, int num, session_dict* session = nullptr, bool refs = false) {
+        buff->clean();
+        encode_append(L, buff, index, num, session, refs);
         return buff->get_slice();
     }
 
-    inline int encode(lua_State* L, luabuf* buff) {
+    inline int encode(lua_State* L, luabuf* buff, bool refs = false) {
         size_t data_len = 0;
-        slice* slice = encode_slice(L, buff, 1, 1);
+        slice* slice = encode_slice(L, buff, 1, 1, nullptr, refs);
         cpchar data = (cpchar)slice->data(&data_len);
         lua_pushlstring(L, data, data_len);
         return 1;
@@ -209,19 +716,153 @@ namespace luakit {
         lua_pushlstring(L, str, sz);
     }
 
+    inline void session_decode(lua_State* L, slice* slice) {
+        uint8_t pos = slice->read();
+        uint8_t sz = slice->read();
+        auto str = (cpchar)slice->peek(sz);
+        if (str == nullptr) {
+            throw lua_exception("decode string is out of range");
+        }
+        slice->erase(sz);
+        t_session->define(pos, str, sz);
+        lua_pushlstring(L, str, sz);
+    }
+
     inline void index_decode(lua_State* L, slice* slice) {
         uint8_t index = slice->read();
-        vstring str = find_string(index);
+        vstring str = t_session ? t_session->find(index) : find_string(index);
         lua_pushlstring(L, str.data(), str.size());
     }
 
-    inline void table_decode(lua_State* L, slice* slice) {
-        lua_createtable(L, 0, 8);
-        do {
-            if (decode_one(L, slice) == type_tab_tail) break;
+    //登记栈顶刚创建的表，子元素解码之前登记，环可以引用到祖先
+    inline void tabdef_register(lua_State* L) {
+        t_tabdef = false;
+        if (t_tabdefs == 0) {
+            lua_createtable(L, 8, 0);
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, &tabref_registry);
+        } else {
+            lua_rawgetp(L, LUA_REGISTRYINDEX, &tabref_registry);
+        }
+        lua_pushvalue(L, -2);
+        lua_rawseti(L, -2, ++t_tabdefs);
+        lua_pop(L, 1);
+    }
+
+    //type之后是否为表的编码，扩展类型只检查子类型不消费
+    inline bool table_type(slice* slice, uint8_t type) {
+        if (type == type_tab_head) return true;
+        if (type != type_ext) return false;
+        uint8_t* ext = slice->peek(1);
+        return ext && ext_table(*ext);
+    }
+
+    inline void tabdef_decode(lua_State* L, slice* slice) {
+        uint8_t type = slice->read();
+        if (!table_type(slice, type)) {
+            throw lua_exception("decode table define has type {}", type);
+        }
+        t_tabdef = true;
+        decode_value(L, slice, type);
+    }
+
+    inline void tabref_decode(lua_State* L, slice* slice) {
+        uint64_t index = slice->read_varint();
+        if (index >= t_tabdefs) {
+            throw lua_exception("decode table reference {} is out of range", index);
+        }
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &tabref_registry);
+        lua_rawgeti(L, -1, (lua_Integer)index + 1);
+        lua_remove(L, -2);
+    }
+
+    inline void table_decode(lua_State* L, slice* slice, int nrec = 8) {
+        lua_createtable(L, 0, nrec);
+        if (t_tabdef) tabdef_register(L);
+        while (true) {
+            uint8_t ktype = slice->read();
+            if (ktype == type_tab_tail) break;
+            decode_value(L, slice, ktype);
+            decode_one(L, slice);
+            lua_rawset(L, -3);
+        }
+    }
+
+    inline void array_decode(lua_State* L, slice* slice) {
+        uint64_t count = slice->read_varint();
+        //每个元素至少1字节，避免按伪造的长度分配
+        if (count > slice->size()) {
+            throw lua_exception("decode array count {} is out of range", count);
+        }
+        lua_createtable(L, (int)count, 0);
+        if (t_tabdef) tabdef_register(L);
+        for (uint64_t i = 1; i <= count; ++i) {
             decode_one(L, slice);
+            lua_rawseti(L, -2, i);
+        }
+    }
+
+    inline void record_decode(lua_State* L, slice* slice) {
+        uint64_t id = slice->read_varint();
+        push_schema_registry(L);
+        if (id > UINT32_MAX || lua_rawgeti(L, -1, (lua_Integer)id) != LUA_TTABLE) {
+            lua_pop(L, 2);
+            throw lua_exception("decode schema {} is not registered", id);
+        }
+        lua_remove(L, -2);
+        int meta = lua_gettop(L);
+        lua_rawgetp(L, meta, &schema_registry);
+        int info = meta + 1;
+        size_t count = lua_rawlen(L, info);
+        if (count > slice->size()) {
+            throw lua_exception("decode schema {} is out of range", id);
+        }
+        lua_createtable(L, 0, (int)count);
+        if (t_tabdef) tabdef_register(L);
+        for (size_t i = 1; i <= count; ++i) {
+            decode_one(L, slice);
+            if (lua_isnil(L, -1)) {
+                lua_pop(L, 1);
+                continue;
+            }
+            lua_rawgeti(L, info, i);
+            lua_insert(L, -2);
             lua_rawset(L, -3);
-        } while (true);
+        }
+        lua_pushvalue(L, meta);
+        lua_setmetatable(L, -2);
+        lua_replace(L, meta);
+        lua_settop(L, meta);
+    }
+
+    inline void map_decode(lua_State* L, slice* slice) {
+        uint8_t exp = slice->read();
+        //每个键值对至少2字节
+        size_t nrec = std::min<size_t>((size_t)1 << std::min(exp, max_size_hint), slice->size() / 2);
+        table_decode(L, slice, (int)nrec);
+    }
+
+    inline void ext_decode(lua_State* L, slice* slice) {
+        uint8_t ext = slice->read();
+        switch (ext) {
+        case ext_array:
+            array_decode(L, slice);
+            break;
+        case ext_map:
+            map_decode(L, slice);
+            break;
+        case ext_record:
+            record_decode(L, slice);
+            break;
+        case ext_tabdef:
+            tabdef_decode(L, slice);
+            break;
+        case ext_tabref:
+            tabref_decode(L, slice);
+            break;
+        default:
+            throw lua_exception("decode extend type {} is invalid", ext);
+        }
     }
 
     inline void decode_value(lua_State* L, slice* slice, uint8_t type) {
@@ -248,7 +889,7 @@ namespace luakit {
             string_decode(L, slice->read<uint32_t>(), slice);
             break;
         case type_istring:
-            string_decode(L, slice->read(), slice, true);
+            t_session ? session_decode(L, slice) : string_decode(L, slice->read(), slice, true);
             break;
         case type_strindex:
             index_decode(L, slice);
@@ -256,7 +897,8 @@ namespace luakit {
         case type_tab_head:
             table_decode(L, slice);
             break;
-        case type_tab_tail:
+        case type_ext:
+            ext_decode(L, slice);
             break;
         case type_int16:
             lua_pushinteger(L, slice->read<int16_t>());
@@ -282,9 +924,11 @@ namespace luakit {
         return type;
     }
 
-    inline int decode_slice(lua_State* L, slice* slice) {
+    inline int decode_slice(lua_State* L, slice* slice, session_dict* session = nullptr) {
+        session_scope scope(session);
         if (!slice) return 0;
         t_sshares.clear();
+        tabref_scope refs(L);
         int top = lua_gettop(L);
         uint8_t argnum = slice->read();
         lua_checkstack(L, argnum);
@@ -295,6 +939,7 @@ namespace luakit {
         if (argnum != getnum) {
             throw lua_exception("decode arg num expect {}, but get {}", argnum, getnum);
         }
+        scope.commit();
         return getnum;
     }
 
@@ -311,40 +956,299 @@ namespace luakit {
         return 0;
     }
 
-    inline void serialize_value(luabuf* buff, cpchar str) {
-        buff->push_data((cpbyte)str, strlen(str));
-    }
-
-    inline void serialize_quote(luabuf* buff, cpchar str, cpchar l, cpchar r) {
-        serialize_value(buff, l);
-        serialize_value(buff, str);
-        serialize_value(buff, r);
-    }
-
-    inline void serialize_udata(luabuf* buff, void* data) {
-        std::string udata = "userdata:" + std::to_string((size_t)data);
-        serialize_quote(buff, udata.c_str(), "'", "'");
+    //直接解码slice(如mapped_slice)，不拷贝数据，也不移动slice的读取位置
+    inline int decode(lua_State* L, slice* slice) {
+        if (!slice) {
+            luaL_error(L, "decode slice is nil");
+            return 0;
+        }
+        try {
+            auto mslice = slice->clone();
+            return decode_slice(L, &mslice);
+        } catch (const std::exception& e){
+            luaL_error(L, e.what());
+        }
+        return 0;
     }
 
-    inline void serialize_crcn(luabuf* buff, int count, size_t line) {
-        if (line > 0) {
-            serialize_value(buff, "\n");
-            for (int i = 1; i < count; ++i) {
-                serialize_value(buff, "    ");
+    //lua: pack_array(fmt, tab, swap)，把数组打包为二进制串
+    inline int pack_array(lua_State* L, luabuf* buff) {
+        cpchar fmt = luaL_checkstring(L, 1);
+        luaL_checktype(L, 2, LUA_TTABLE);
+        bool swap = lua_toboolean(L, 3);
+        size_t count = lua_rawlen(L, 2);
+        buff->clean();
+        bool valid = array_dispatch(fmt[0], [&](auto tag) {
+            using T = decltype(tag);
+            T vals[ARRAY_BATCH];
+            for (size_t i = 0; i < count; i += ARRAY_BATCH) {
+                size_t n = std::min(ARRAY_BATCH, count - i);
+                for (size_t j = 0; j < n; ++j) {
+                    lua_rawgeti(L, 2, i + j + 1);
+                    if constexpr (std::is_floating_point_v<T>) {
+                        vals[j] = (T)lua_tonumber(L, -1);
+                    } else {
+                        vals[j] = (T)lua_tointeger(L, -1);
+                    }
+                    lua_pop(L, 1);
+                }
+                if (buff->write_array(vals, n, swap) == 0) {
+                    luaL_error(L, "pack array can't pack too long (%I) array", (lua_Integer)count);
+                }
             }
+        });
+        if (!valid) {
+            luaL_error(L, "invalid array format: %s", fmt);
         }
+        size_t data_len = 0;
+        cpchar data = (cpchar)buff->data(&data_len);
+        lua_pushlstring(L, data, data_len);
+        return 1;
     }
 
-    inline void serialize_string(lua_State* L, luabuf* buff, int index) {
-        size_t sz;
-        serialize_value(buff, "'");
-        cpchar str = luaL_checklstring(L, index, &sz);
-        if (sz > 0) {
-            buff->push_data((cpbyte)str, sz);
+    //lua: pack_varints(tab, zigzag)，把整数数组打包为varint串
+    inline int pack_varints(lua_State* L, luabuf* buff) {
+        luaL_checktype(L, 1, LUA_TTABLE);
+        bool zigzag = lua_toboolean(L, 2);
+        size_t count = lua_rawlen(L, 1);
+        buff->clean();
+        uint64_t vals[ARRAY_BATCH];
+        for (size_t i = 0; i < count; i += ARRAY_BATCH) {
+            size_t n = std::min(ARRAY_BATCH, count - i);
+            for (size_t j = 0; j < n; ++j) {
+                lua_rawgeti(L, 1, i + j + 1);
+                lua_Integer val = lua_tointeger(L, -1);
+                vals[j] = zigzag ? zigzag_encode(val) : (uint64_t)val;
+                lua_pop(L, 1);
+            }
+            if (buff->write_varints(vals, n) == 0) {
+                luaL_error(L, "pack varints can't pack too long (%I) array", (lua_Integer)count);
+            }
+        }
+        size_t data_len = 0;
+        cpchar data = (cpchar)buff->data(&data_len);
+        lua_pushlstring(L, data, data_len);
+        return 1;
+    }
+
+    //luakit.compress(str)：varint原始长度 + lz块
+    inline int lua_compress(lua_State* L, luabuf* buff) {
+        size_t len = 0;
+        auto data = (const uint8_t*)luaL_checklstring(L, 1, &len);
+        buff->clean();
+        buff->write_varint(len);
+        uint8_t* dest = buff->peek_space(lz_bound(len));
+        if (!dest) {
+            luaL_error(L, "compress data is too long");
+            return 0;
+        }
+        buff->pop_space(lz_compress(data, len, dest));
+        vstring str = buff->string();
+        lua_pushlstring(L, str.data(), str.size());
+        return 1;
+    }
+
+    inline int lua_decompress(lua_State* L, luabuf* buff) {
+        size_t len = 0;
+        auto data = (const uint8_t*)luaL_checklstring(L, 1, &len);
+        uint64_t raw_len = 0;
+        size_t n = varint_decode(data, len, &raw_len);
+        buff->clean();
+        uint8_t* dest = (n > 0 && raw_len <= BUFFER_MAX) ? buff->peek_space(raw_len) : nullptr;
+        if (!dest || !lz_decompress(data + n, len - n, dest, raw_len)) {
+            luaL_error(L, "decompress data is invalid");
+            return 0;
+        }
+        lua_pushlstring(L, (cpchar)dest, raw_len);
+        return 1;
+    }
+
+    inline void push_buff_stats(lua_State* L, const buff_stats& stats) {
+        lua_createtable(L, 0, 6);
+        lua_pushinteger(L, stats.resizes);
+        lua_setfield(L, -2, "resizes");
+        lua_pushinteger(L, stats.compacts);
+        lua_setfield(L, -2, "compacts");
+        lua_pushinteger(L, stats.moved);
+        lua_setfield(L, -2, "moved");
+        lua_pushinteger(L, stats.peak);
+        lua_setfield(L, -2, "peak");
+        lua_pushinteger(L, stats.space_fails);
+        lua_setfield(L, -2, "space_fails");
+        lua_pushinteger(L, stats.max_time);
+        lua_setfield(L, -2, "max_time");
+    }
+
+    //lua: buff_stats(reset)，当前线程luabuf统计，以及编码buff的统计
+    //未定义LUAKIT_BUFF_STATS时返回nil
+    inline int lua_buff_stats(lua_State* L, [[maybe_unused]] luabuf* buff) {
+#ifdef LUAKIT_BUFF_STATS
+        bool reset = lua_toboolean(L, 1);
+        push_buff_stats(L, t_buff_stats);
+        push_buff_stats(L, buff->stats());
+        if (reset) {
+            t_buff_stats = buff_stats();
+        }
+        return 2;
+#else
+        lua_pushnil(L);
+        return 1;
+#endif
+    }
+
+    //缩进：换行 + 每层4个空格，一次写入
+    const size_t serialize_indent   = 4;
+    inline constexpr auto serialize_indents = [] {
+        std::array<char, 1 + serialize_indent * max_encode_depth> indents = {};
+        indents.fill(' ');
+        indents[0] = '\n';
+        return indents;
+    }();
+
+    inline void serialize_value(luabuf* buff, vstring str) {
+        buff->push_data((cpbyte)str.data(), str.size());
+    }
+
+    inline void serialize_quote(luabuf* buff, vstring str, vstring l, vstring r) {
+        serialize_value(buff, l);
+        serialize_value(buff, str);
+        serialize_value(buff, r);
+    }
+
+    inline void serialize_udata(luabuf* buff, void* data) {
+        char buf[32];
+        auto res = std::to_chars(buf, buf + sizeof(buf), (size_t)data);
+        serialize_quote(buff, vstring(buf, res.ptr - buf), "'userdata:", "'");
+    }
+
+    inline void serialize_crcn(luabuf* buff, int count, size_t line) {
+        if (line > 0) {
+            size_t depth = std::min<size_t>(count > 1 ? count - 1 : 0, max_encode_depth);
+            buff->push_data((cpbyte)serialize_indents.data(), 1 + depth * serialize_indent);
+        }
+    }
+
+    //整数和浮点数按最短往返格式输出，浮点数保留小数点，读回时类型不变
+    inline void serialize_number(lua_State* L, luabuf* buff, int index) {
+        char buf[64];
+        if (lua_isinteger(L, index)) {
+            lua_Integer val = lua_tointeger(L, index);
+            if (val == LUA_MININTEGER) {
+                //十进制字面量会被读成浮点数
+                serialize_value(buff, "0x8000000000000000");
+                return;
+            }
+            auto res = std::to_chars(buf, buf + sizeof(buf), val);
+            buff->push_data((cpbyte)buf, res.ptr - buf);
+            return;
+        }
+        double val = lua_tonumber(L, index);
+        if (std::isnan(val)) {
+            serialize_value(buff, "0/0");
+            return;
+        }
+        if (std::isinf(val)) {
+            serialize_value(buff, val > 0 ? "1/0" : "-1/0");
+            return;
+        }
+        auto res = std::to_chars(buf, buf + sizeof(buf), val);
+        buff->push_data((cpbyte)buf, res.ptr - buf);
+        if (std::find_if(buf, res.ptr, [](char c) { return c == '.' || c == 'e'; }) == res.ptr) {
+            serialize_value(buff, ".0");
+        }
+    }
+
+    //控制字符、引号和反斜杠需要转义
+    inline bool serialize_escaped(uint8_t c) {
+        return c < 0x20 || c == '\'' || c == '\\';
+    }
+
+    //查找下一个需要转义的字符，没有时返回len
+    inline size_t serialize_scan(const uint8_t* str, size_t pos, size_t len) {
+#if defined(__SSE2__)
+        const __m128i quote = _mm_set1_epi8('\'');
+        const __m128i slash = _mm_set1_epi8('\\');
+        const __m128i ctrl = _mm_set1_epi8(0x1f);
+        for (; pos + 16 <= len; pos += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(str + pos));
+            __m128i m = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v),
+                _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)));
+            uint32_t mask = (uint32_t)_mm_movemask_epi8(m);
+            if (mask) return pos + std::countr_zero(mask);
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const uint8x16_t quote = vdupq_n_u8('\'');
+        const uint8x16_t slash = vdupq_n_u8('\\');
+        const uint8x16_t ctrl = vdupq_n_u8(0x1f);
+        for (; pos + 16 <= len; pos += 16) {
+            uint8x16_t v = vld1q_u8(str + pos);
+            uint8x16_t m = vorrq_u8(vcleq_u8(v, ctrl), vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, slash)));
+            if (vmaxvq_u8(m)) break;
+        }
+#endif
+        while (pos < len && !serialize_escaped(str[pos])) pos++;
+        return pos;
+    }
+
+    inline void serialize_escape(luabuf* buff, uint8_t c) {
+        switch (c) {
+        case '\n': serialize_value(buff, "\\n"); break;
+        case '\r': serialize_value(buff, "\\r"); break;
+        case '\t': serialize_value(buff, "\\t"); break;
+        case '\'': serialize_value(buff, "\\'"); break;
+        case '\\': serialize_value(buff, "\\\\"); break;
+        default: {
+            //固定3位，避免与后面的数字连在一起
+            char buf[4] = { '\\', (char)('0' + c / 100), (char)('0' + c / 10 % 10), (char)('0' + c % 10) };
+            buff->push_data((cpbyte)buf, sizeof(buf));
+            break;
+        }
+        }
+    }
+
+    inline void serialize_string(lua_State* L, luabuf* buff, int index) {
+        size_t sz;
+        auto str = (const uint8_t*)luaL_checklstring(L, index, &sz);
+        serialize_value(buff, "'");
+        size_t pos = 0;
+        while (pos < sz) {
+            size_t next = serialize_scan(str, pos, sz);
+            if (next > pos) buff->push_data(str + pos, next - pos);
+            if (next == sz) break;
+            serialize_escape(buff, str[next]);
+            pos = next + 1;
         }
         serialize_value(buff, "'");
     }
 
+    //可以直接作为键名的标识符：非关键字
+    inline bool serialize_identifier(vstring str) {
+        static const vstring keywords[] = {
+            "and", "break", "do", "else", "elseif", "end", "false", "for", "function", "goto", "if",
+            "in", "local", "nil", "not", "or", "repeat", "return", "then", "true", "until", "while"
+        };
+        if (str.empty() || isdigit((uint8_t)str[0])) return false;
+        for (char c : str) {
+            if (!isalnum((uint8_t)c) && c != '_') return false;
+        }
+        return std::find(std::begin(keywords), std::end(keywords), str) == std::end(keywords);
+    }
+
+    inline void serialize_key(lua_State* L, luabuf* buff, int index, int depth, size_t line) {
+        if (lua_type(L, index) == LUA_TSTRING) {
+            size_t sz;
+            cpchar str = lua_tolstring(L, index, &sz);
+            if (serialize_identifier(vstring(str, sz))) {
+                buff->push_data((cpbyte)str, sz);
+                serialize_value(buff, "=");
+                return;
+            }
+        }
+        serialize_value(buff, "[");
+        serialize_one(L, buff, index, depth, line);
+        serialize_value(buff, "]=");
+    }
+
     inline void serialize_table(lua_State* L, luabuf* buff, int index, int depth, size_t line) {
         int size = 0;
         index = lua_absindex(L, index);
@@ -380,19 +1284,7 @@ namespace luakit {
                     lua_geti(L, -1, 1);
                     lua_geti(L, -2, 2);
                     serialize_crcn(buff, depth, line);
-                    if (lua_type(L, -2) == LUA_TNUMBER) {
-                        lua_pushvalue(L, -2);
-                        serialize_quote(buff, lua_tostring(L, -1), "[", "]=");
-                        lua_pop(L, 1);
-                    }
-                    else if (lua_type(L, -2) == LUA_TSTRING) {
-                        serialize_value(buff, lua_tostring(L, -2));
-                        serialize_value(buff, "=");
-                    }
-                    else {
-                        serialize_one(L, buff, -2, depth, line);
-                        serialize_value(buff, "=");
-                    }
+                    serialize_key(L, buff, -2, depth, line);
                     serialize_one(L, buff, -1, depth, line);
                     lua_pop(L, 3);
                 }
@@ -404,19 +1296,7 @@ namespace luakit {
                         serialize_value(buff, ",");
                     }
                     serialize_crcn(buff, depth, line);
-                    if (lua_type(L, -2) == LUA_TNUMBER) {
-                        lua_pushvalue(L, -2);
-                        serialize_quote(buff, lua_tostring(L, -1), "[", "]=");
-                        lua_pop(L, 1);
-                    }
-                    else if (lua_type(L, -2) == LUA_TSTRING) {
-                        serialize_value(buff, lua_tostring(L, -2));
-                        serialize_value(buff, "=");
-                    }
-                    else {
-                        serialize_one(L, buff, -2, depth, line);
-                        serialize_value(buff, "=");
-                    }
+                    serialize_key(L, buff, -2, depth, line);
                     serialize_one(L, buff, -1, depth, line);
                     lua_pop(L, 1);
                 }
@@ -444,7 +1324,7 @@ namespace luakit {
             serialize_string(L, buff, index);
             break;
         case LUA_TNUMBER:
-            serialize_value(buff, lua_tostring(L, index));
+            serialize_number(L, buff, index);
             break;
         case LUA_TTABLE:
             serialize_table(L, buff, index, depth + 1, line);
@@ -468,46 +1348,849 @@ namespace luakit {
         return 1;
     }
 
+    const size_t max_parse_depth    = 128;  //字面量嵌套层数上限
+    const int literal_chunk         = 256;  //表项先压栈，每满一批写入表
+
+    //lua字面量解析器：只解析serialize输出的子集(表、字符串、数值、布尔、nil)，不执行任何代码
+    //数值支持十进制、十六进制和a/b形式(1/0、-1/0、0/0)，字符串支持lua的转义
+    class literal_parser {
+    public:
+        literal_parser(lua_State* L, cpchar data, size_t len) : m_L(L), m_ptr(data), m_end(data + len), m_begin(data) {}
+
+        //解析一个值压栈，没有内容时压入nil
+        void parse() {
+            _skip();
+            if (m_ptr == m_end) {
+                lua_pushnil(m_L);
+                return;
+            }
+            _value(0);
+            _skip();
+            if (m_ptr != m_end) _error("unexpected symbol");
+        }
+
+    protected:
+        [[noreturn]] void _error(cpchar msg) {
+            throw lua_exception("unserialize {} near {}", msg, m_ptr - m_begin);
+        }
+
+        void _skip() {
+            while (m_ptr < m_end && isspace((uint8_t)*m_ptr)) m_ptr++;
+        }
+
+        bool _peek(char c) {
+            _skip();
+            return m_ptr < m_end && *m_ptr == c;
+        }
+
+        void _expect(char c) {
+            if (!_peek(c)) _error("unexpected symbol");
+            m_ptr++;
+        }
+
+        vstring _name() {
+            cpchar start = m_ptr;
+            while (m_ptr < m_end && (isalnum((uint8_t)*m_ptr) || *m_ptr == '_')) m_ptr++;
+            return vstring(start, m_ptr - start);
+        }
+
+        void _value(size_t depth) {
+            _skip();
+            if (m_ptr == m_end) _error("unexpected end");
+            char c = *m_ptr;
+            if (c == '{') return _table(depth);
+            if (c == '\'' || c == '"') return _string();
+            if (c == '-' || c == '.' || isdigit((uint8_t)c)) return _number();
+            vstring name = _name();
+            if (name == "true") return lua_pushboolean(m_L, true);
+            if (name == "false") return lua_pushboolean(m_L, false);
+            if (name == "nil") return lua_pushnil(m_L);
+            _error("unexpected symbol");
+        }
+
+        //数值字面量，不含符号
+        void _literal(lua_Integer& ival, double& nval, bool& isint) {
+            cpchar start = m_ptr;
+            if (m_end - m_ptr > 2 && m_ptr[0] == '0' && (m_ptr[1] == 'x' || m_ptr[1] == 'X')) {
+                m_ptr += 2;
+                cpchar digits = m_ptr;
+                while (m_ptr < m_end && (isxdigit((uint8_t)*m_ptr) || *m_ptr == '.' || *m_ptr == 'p' || *m_ptr == 'P' ||
+                    ((*m_ptr == '+' || *m_ptr == '-') && m_ptr > digits && (m_ptr[-1] == 'p' || m_ptr[-1] == 'P')))) m_ptr++;
+                vstring token(digits, m_ptr - digits);
+                if (token.find_first_of(".pP") == vstring::npos) {
+                    //十六进制整数按lua的规则回绕
+                    uint64_t val = 0;
+                    for (char h : token) {
+                        val = (val << 4) | (uint64_t)(isdigit((uint8_t)h) ? h - '0' : (tolower(h) - 'a' + 10));
+                    }
+                    isint = !token.empty();
+                    ival = (lua_Integer)val;
+                    if (isint) return;
+                } else {
+                    auto res = std::from_chars(digits, m_ptr, nval, std::chars_format::hex);
+                    isint = false;
+                    if (res.ec == std::errc() && res.ptr == m_ptr) return;
+                }
+                m_ptr = start;
+                _error("malformed number");
+            }
+            while (m_ptr < m_end && (isdigit((uint8_t)*m_ptr) || *m_ptr == '.' || *m_ptr == 'e' || *m_ptr == 'E' ||
+                ((*m_ptr == '+' || *m_ptr == '-') && m_ptr > start && (m_ptr[-1] == 'e' || m_ptr[-1] == 'E')))) m_ptr++;
+            vstring token(start, m_ptr - start);
+            if (token.find_first_of(".eE") == vstring::npos) {
+                uint64_t val = 0;
+                auto res = std::from_chars(start, m_ptr, val);
+                //超出范围的十进制整数按浮点数处理
+                if (res.ec == std::errc() && res.ptr == m_ptr && val <= (uint64_t)std::numeric_limits<lua_Integer>::max()) {
+                    isint = true;
+                    ival = (lua_Integer)val;
+                    return;
+                }
+            }
+            isint = false;
+            auto res = std::from_chars(start, m_ptr, nval);
+            if (res.ec == std::errc::result_out_of_range && res.ptr == m_ptr) {
+                //溢出时from_chars不写入结果，按lua的规则取inf或0
+                nval = strtod(std::string(token).c_str(), nullptr);
+                return;
+            }
+            if (res.ec != std::errc() || res.ptr != m_ptr) {
+                m_ptr = start;
+                _error("malformed number");
+            }
+        }
+
+        void _number() {
+            bool neg = false, isint = false;
+            lua_Integer ival = 0;
+            double nval = 0;
+            if (*m_ptr == '-') {
+                neg = true;
+                m_ptr++;
+                _skip();
+            }
+            _literal(ival, nval, isint);
+            if (neg) {
+                ival = (lua_Integer)(0 - (lua_Unsigned)ival);
+                nval = -nval;
+            }
+            if (_peek('/')) {
+                //除法结果总是浮点数
+                double num = isint ? (double)ival : nval;
+                m_ptr++;
+                _skip();
+                _literal(ival, nval, isint);
+                lua_pushnumber(m_L, num / (isint ? (double)ival : nval));
+                return;
+            }
+            isint ? lua_pushinteger(m_L, ival) : lua_pushnumber(m_L, nval);
+        }
+
+        void _utf8(uint32_t code) {
+            char buf[8];
+            size_t n = 0;
+            if (code < 0x80) {
+                buf[n++] = (char)code;
+            } else if (code < 0x800) {
+                buf[n++] = (char)(0xC0 | (code >> 6));
+                buf[n++] = (char)(0x80 | (code & 0x3F));
+            } else if (code < 0x10000) {
+                buf[n++] = (char)(0xE0 | (code >> 12));
+                buf[n++] = (char)(0x80 | ((code >> 6) & 0x3F));
+                buf[n++] = (char)(0x80 | (code & 0x3F));
+            } else {
+                buf[n++] = (char)(0xF0 | (code >> 18));
+                buf[n++] = (char)(0x80 | ((code >> 12) & 0x3F));
+                buf[n++] = (char)(0x80 | ((code >> 6) & 0x3F));
+                buf[n++] = (char)(0x80 | (code & 0x3F));
+            }
+            m_str.append(buf, n);
+        }
+
+        void _escape() {
+            if (m_ptr == m_end) _error("unfinished string");
+            char c = *m_ptr++;
+            switch (c) {
+            case 'n': m_str.push_back('\n'); return;
+            case 't': m_str.push_back('\t'); return;
+            case 'r': m_str.push_back('\r'); return;
+            case 'a': m_str.push_back('\a'); return;
+            case 'b': m_str.push_back('\b'); return;
+            case 'f': m_str.push_back('\f'); return;
+            case 'v': m_str.push_back('\v'); return;
+            case '\\': case '\'': case '"': m_str.push_back(c); return;
+            case '\n': case '\r':
+                m_str.push_back('\n');
+                if (m_ptr < m_end && (*m_ptr == '\n' || *m_ptr == '\r') && *m_ptr != c) m_ptr++;
+                return;
+            case 'z':
+                while (m_ptr < m_end && isspace((uint8_t)*m_ptr)) m_ptr++;
+                return;
+            case 'x': {
+                if (m_end - m_ptr < 2 || !isxdigit((uint8_t)m_ptr[0]) || !isxdigit((uint8_t)m_ptr[1])) _error("invalid escape");
+                uint8_t val = 0;
+                std::from_chars(m_ptr, m_ptr + 2, val, 16);
+                m_ptr += 2;
+                m_str.push_back((char)val);
+                return;
+            }
+            case 'u': {
+                uint32_t code = 0;
+                if (m_ptr == m_end || *m_ptr++ != '{') _error("invalid escape");
+                auto res = std::from_chars(m_ptr, m_end, code, 16);
+                if (res.ec != std::errc() || res.ptr == m_end || *res.ptr != '}' || code > 0x10FFFF) _error("invalid escape");
+                m_ptr = res.ptr + 1;
+                _utf8(code);
+                return;
+            }
+            }
+            if (!isdigit((uint8_t)c)) _error("invalid escape");
+            uint32_t val = c - '0';
+            for (int i = 0; i < 2 && m_ptr < m_end && isdigit((uint8_t)*m_ptr); ++i) {
+                val = val * 10 + (*m_ptr++ - '0');
+            }
+            if (val > UCHAR_MAX) _error("invalid escape");
+            m_str.push_back((char)val);
+        }
+
+        //没有转义时直接从源数据压栈
+        void _string() {
+            char quote = *m_ptr++;
+            cpchar start = m_ptr;
+            while (m_ptr < m_end && *m_ptr != quote && *m_ptr != '\\' && *m_ptr != '\n' && *m_ptr != '\r') m_ptr++;
+            if (m_ptr < m_end && *m_ptr == quote) {
+                lua_pushlstring(m_L, start, m_ptr++ - start);
+                return;
+            }
+            m_str.assign(start, m_ptr - start);
+            while (true) {
+                if (m_ptr == m_end || *m_ptr == '\n' || *m_ptr == '\r') _error("unfinished string");
+                char c = *m_ptr++;
+                if (c == quote) break;
+                if (c == '\\') {
+                    _escape();
+                    continue;
+                }
+                m_str.push_back(c);
+            }
+            lua_pushlstring(m_L, m_str.data(), m_str.size());
+        }
+
+        //表项以键值对压栈，攒满一批或表结束时写入
+        //第一批写入时按这一批的个数建表，小表的预分配是精确的
+        void _table(size_t depth) {
+            if (depth >= max_parse_depth) _error("table is too depth");
+            luaL_checkstack(m_L, literal_chunk * 2 + 8, "unserialize table is too depth");
+            m_ptr++;
+            int table = lua_gettop(m_L) + 1;
+            lua_pushnil(m_L);
+            bool created = false;
+            int narr = 0, nrec = 0;
+            lua_Integer index = 0;
+            while (!_peek('}')) {
+                if (m_ptr == m_end) _error("'}' expected");
+                if (*m_ptr == '[') {
+                    m_ptr++;
+                    _value(depth + 1);
+                    if (lua_isnil(m_L, -1) || (lua_type(m_L, -1) == LUA_TNUMBER && lua_tonumber(m_L, -1) != lua_tonumber(m_L, -1))) {
+                        _error("table index is nil or nan");
+                    }
+                    _expect(']');
+                    _expect('=');
+                    nrec++;
+                } else if (isalpha((uint8_t)*m_ptr) || *m_ptr == '_') {
+                    cpchar start = m_ptr;
+                    vstring name = _name();
+                    if (_peek('=') && (m_ptr + 1 == m_end || m_ptr[1] != '=')) {
+                        m_ptr++;
+                        lua_pushlstring(m_L, name.data(), name.size());
+                        nrec++;
+                    } else {
+                        m_ptr = start;
+                        lua_pushinteger(m_L, ++index);
+                        narr++;
+                    }
+                } else {
+                    lua_pushinteger(m_L, ++index);
+                    narr++;
+                }
+                _value(depth + 1);
+                if (narr + nrec >= literal_chunk) {
+                    _flush(table, created, narr, nrec);
+                    narr = nrec = 0;
+                }
+                if (_peek(',') || _peek(';')) {
+                    m_ptr++;
+                    continue;
+                }
+                if (!_peek('}')) _error("'}' expected");
+            }
+            m_ptr++;
+            _flush(table, created, narr, nrec);
+        }
+
+        void _flush(int table, bool& created, int narr, int nrec) {
+            if (!created) {
+                lua_createtable(m_L, narr, nrec);
+                lua_replace(m_L, table);
+                created = true;
+            }
+            int top = lua_gettop(m_L);
+            for (int i = table + 1; i < top; i += 2) {
+                if (lua_isnil(m_L, i + 1)) continue;
+                lua_pushvalue(m_L, i);
+                lua_pushvalue(m_L, i + 1);
+                lua_rawset(m_L, table);
+            }
+            lua_settop(m_L, table);
+        }
+
+    private:
+        lua_State* m_L;
+        cpchar m_ptr;
+        cpchar m_end;
+        cpchar m_begin;
+        std::string m_str;
+    };
+
+    //失败时返回nil和错误信息
     inline int unserialize(lua_State* L) {
         size_t data_len = 0;
-        std::string temp = "return ";
         auto data = luaL_checklstring(L, 1, &data_len);
-        temp.append(data, data_len);
-        if (luaL_loadbufferx(L, temp.c_str(), temp.size(), "unserialize", "bt") == 0) {
-            if (lua_pcall(L, 0, 1, 0) == 0) {
-                return 1;
-            }
+        int top = lua_gettop(L);
+        try {
+            literal_parser parser(L, data, data_len);
+            parser.parse();
+            return 1;
+        } catch (const std::exception& e) {
+            lua_settop(L, top);
+            lua_pushnil(L);
+            lua_pushstring(L, e.what());
         }
-        lua_pushnil(L);
-        lua_insert(L, -2);
         return 2;
     }
 
-    template<typename T>
-    void typeval_encode(luabuf* buff, T data);
+    //结构描述：特化lua_reflect<T>，提供constexpr的fields元组
+    //  template <> struct lua_reflect<player> {
+    //      static constexpr auto fields = std::make_tuple(lua_field("id", &player::id), lua_field("name", &player::name));
+    //  };
+    //可选提供static constexpr uint32_t schema，按已注册结构(ext_record)编码，字段顺序需与注册时一致
+    template <typename T>
+    struct lua_reflect;
+
+    template <typename T, typename M>
+    struct field_desc {
+        cpchar name;
+        M T::* member;
+    };
+
+    template <typename T, typename M>
+    constexpr field_desc<T, M> lua_field(cpchar name, M T::* member) {
+        return { name, member };
+    }
+
+    template <typename T>
+    concept lua_reflected = requires { lua_reflect<T>::fields; };
+    template <typename T>
+    concept lua_schema = lua_reflected<T> && requires { lua_reflect<T>::schema; };
+
+    //按反射信息注册结构，结构元表留在栈顶
+    //已注册(如lua中先注册)时检查字段顺序与lua_reflect<T>::fields一致，不一致抛出lua_exception
+    template <lua_schema T>
+    inline void schema_register(lua_State* L) {
+        lua_Integer id = lua_reflect<T>::schema;
+        std::vector<cpchar> names;
+        std::apply([&](const auto&... field) {
+            (names.push_back(field.name), ...);
+        }, lua_reflect<T>::fields);
+        push_schema_registry(L);
+        if (lua_rawgeti(L, -1, id) == LUA_TTABLE) {
+            lua_rawgetp(L, -1, &schema_registry);
+            bool same = lua_istable(L, -1) && lua_rawlen(L, -1) == names.size();
+            for (size_t i = 0; same && i < names.size(); ++i) {
+                lua_rawgeti(L, -1, i + 1);
+                same = strcmp(lua_tostring(L, -1), names[i]) == 0;
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+            lua_remove(L, -2);
+            if (!same) {
+                lua_pop(L, 1);
+                throw lua_exception("schema {} fields mismatch with native struct", id);
+            }
+            return;
+        }
+        lua_pop(L, 2);
+        lua_createtable(L, (int)names.size(), 0);
+        for (size_t i = 0; i < names.size(); ++i) {
+            lua_pushstring(L, names[i]);
+            lua_rawseti(L, -2, i + 1);
+        }
+        schema_register(L, id, -1, 0);
+        lua_remove(L, -2);
+    }
+
+    //原生数据直接按lua数据的格式编码，不经过lua_State
+    //容器与lua_stack.h中native_to_lua的转换一致：序列和集合为数组，map为表
+    inline void typeval_encode(luabuf* buff, cpchar data);
+    inline void typeval_encode(luabuf* buff, bool data);
+    inline void typeval_encode(luabuf* buff, std::nullptr_t);
+    template <std_integer T> requires (!std::same_as<T, bool>)
+    inline void typeval_encode(luabuf* buff, T data);
+    template <std::floating_point T>
+    inline void typeval_encode(luabuf* buff, T data);
+    template <std_string T>
+    inline void typeval_encode(luabuf* buff, const T& data);
+    template <typename T> requires (std_sequence<T> || std_set<T>)
+    inline void typeval_encode(luabuf* buff, const T& data);
+    template <std_map T>
+    inline void typeval_encode(luabuf* buff, const T& data);
+    template <lua_reflected T>
+    inline void typeval_encode(luabuf* buff, const T& data);
+
     inline void typeval_encode(luabuf* buff, cpchar data) {
         string_write(buff, data, strlen(data));
     }
-    template<std::integral T>
+    //与原来std::integral的编码保持一致，bool按整数0/1编码
+    inline void typeval_encode(luabuf* buff, bool data) {
+        integer_encode(buff, data ? 1 : 0);
+    }
+    inline void typeval_encode(luabuf* buff, std::nullptr_t) {
+        value_encode(buff, type_nil);
+    }
+    template <std_integer T> requires (!std::same_as<T, bool>)
     inline void typeval_encode(luabuf* buff, T data) {
-        integer_encode(buff, data);
+        integer_encode(buff, (int64_t)data);
     }
-    template<std::floating_point T>
+    template <std::floating_point T>
     inline void typeval_encode(luabuf* buff, T data) {
         number_encode(buff, data);
     }
+    template <std_string T>
+    inline void typeval_encode(luabuf* buff, const T& data) {
+        string_write(buff, (cpchar)data.data(), data.size());
+    }
+    template <typename T> requires (std_sequence<T> || std_set<T>)
+    inline void typeval_encode(luabuf* buff, const T& data) {
+        ext_encode(buff, ext_array);
+        buff->write_varint(std::distance(data.begin(), data.end()));
+        for (const auto& item : data) {
+            typeval_encode(buff, item);
+        }
+    }
+
+    //字符串键与lua一样走共享字符串，键位置不能使用扩展类型，不支持容器键
+    template <typename K>
+    inline void typekey_encode(luabuf* buff, const K& key) {
+        static_assert(!std_sequence<K> && !std_set<K> && !std_map<K> && !lua_reflected<K>, "native map key can't be a table");
+        if constexpr (std_string<K>) {
+            index_write(buff, (cpchar)key.data(), key.size());
+        } else if constexpr (std::is_same_v<std::decay_t<K>, cpchar> || std::is_same_v<std::decay_t<K>, char*>) {
+            index_write(buff, key, strlen(key));
+        } else {
+            typeval_encode(buff, key);
+        }
+    }
+
+    template <std_map T>
+    inline void typeval_encode(luabuf* buff, const T& data) {
+        ext_encode(buff, ext_map);
+        value_encode(buff, size_hint(data.size()));
+        for (const auto& [key, value] : data) {
+            typekey_encode(buff, key);
+            typeval_encode(buff, value);
+        }
+        value_encode(buff, type_tab_tail);
+    }
+
+    template <lua_reflected T>
+    inline void typeval_encode(luabuf* buff, const T& data) {
+        constexpr auto& fields = lua_reflect<T>::fields;
+        constexpr size_t count = std::tuple_size_v<std::decay_t<decltype(fields)>>;
+        if constexpr (lua_schema<T>) {
+            ext_encode(buff, ext_record);
+            buff->write_varint(lua_reflect<T>::schema);
+            std::apply([&](const auto&... field) {
+                (typeval_encode(buff, data.*(field.member)), ...);
+            }, fields);
+        } else {
+            ext_encode(buff, ext_map);
+            value_encode(buff, size_hint(count));
+            std::apply([&](const auto&... field) {
+                ((index_write(buff, field.name, strlen(field.name)), typeval_encode(buff, data.*(field.member))), ...);
+            }, fields);
+            value_encode(buff, type_tab_tail);
+        }
+    }
+
+    //原生数据直接从slice解码，不经过lua_State，类型不匹配时抛出lua_exception
+    //string_view指向slice内存，需在slice数据释放前使用；会话模式下的共享键指向字典，需用std::string接收
+    inline void typeval_error(cpchar expect, uint8_t type) {
+        throw lua_exception("decode expect {} but get type {}", expect, type);
+    }
+
+    inline vstring string_read(slice* slice, uint32_t sz) {
+        if (sz == 0) return "";
+        auto str = (cpchar)slice->peek(sz);
+        if (str == nullptr || sz > max_string_size) {
+            throw lua_exception("decode string is out of range");
+        }
+        slice->erase(sz);
+        return vstring(str, sz);
+    }
+
+    //读取字符串，共享字符串同时登记，保证之后的索引对齐
+    inline bool typestr_decode(slice* slice, uint8_t type, vstring& str) {
+        switch (type) {
+        case type_string8:
+            str = string_read(slice, slice->read());
+            return true;
+        case type_string16:
+            str = string_read(slice, slice->read<uint16_t>());
+            return true;
+        case type_string32:
+            str = string_read(slice, slice->read<uint32_t>());
+            return true;
+        case type_istring:
+            if (t_session) {
+                uint8_t pos = slice->read();
+                str = string_read(slice, slice->read());
+                t_session->define(pos, str.data(), str.size());
+            } else {
+                str = string_read(slice, slice->read());
+                t_sshares.push_back(str);
+            }
+            return true;
+        case type_strindex: {
+            uint8_t index = slice->read();
+            if (t_session) {
+                str = t_session->find(index);
+            } else if (index < t_sshares.size()) {
+                str = t_sshares[index];
+            } else {
+                throw lua_exception("decode string index {} is out of range", index);
+            }
+            return true;
+        }
+        }
+        return false;
+    }
+
+    inline bool typeint_decode(slice* slice, uint8_t type, int64_t& val) {
+        switch (type) {
+        case type_int16:
+            val = slice->read<int16_t>();
+            return true;
+        case type_int32:
+            val = slice->read<int32_t>();
+            return true;
+        case type_int64:
+            val = slice->read<int64_t>();
+            return true;
+        }
+        if (type < type_max) return false;
+        val = type - type_max;
+        return true;
+    }
+
+    inline void typeval_skip(slice* slice, uint8_t type);
+
+    inline void typepairs_skip(slice* slice) {
+        while (true) {
+            uint8_t ktype = slice->read();
+            if (ktype == type_tab_tail) break;
+            typeval_skip(slice, ktype);
+            typeval_skip(slice, slice->read());
+        }
+    }
+
+    //跳过不需要的值，结构按t_schemas快照中的字段数跳过
+    inline void typeval_skip(slice* slice, uint8_t type) {
+        vstring str;
+        int64_t integer;
+        if (typestr_decode(slice, type, str) || typeint_decode(slice, type, integer)) return;
+        switch (type) {
+        case type_nil:
+        case type_true:
+        case type_false:
+        case type_undefine:
+            break;
+        case type_number:
+            slice->read<double>();
+            break;
+        case type_tab_head:
+            typepairs_skip(slice);
+            break;
+        case type_ext:
+            switch (uint8_t ext = slice->read()) {
+            case ext_map:
+                slice->read();
+                typepairs_skip(slice);
+                break;
+            case ext_array: {
+                uint64_t count = slice->read_varint();
+                for (uint64_t i = 0; i < count; ++i) {
+                    typeval_skip(slice, slice->read());
+                }
+                break;
+            }
+            case ext_record: {
+                uint64_t id = slice->read_varint();
+                if (!t_schemas || id > UINT32_MAX) {
+                    throw lua_exception("decode can't skip unregistered schema {}", id);
+                }
+                auto it = t_schemas->find((uint32_t)id);
+                if (it == t_schemas->end()) {
+                    throw lua_exception("decode can't skip unregistered schema {}", id);
+                }
+                for (uint32_t i = 0; i < it->second; ++i) {
+                    typeval_skip(slice, slice->read());
+                }
+                break;
+            }
+            case ext_tabdef:
+                typeval_skip(slice, slice->read());
+                break;
+            case ext_tabref:
+                slice->read_varint();
+                break;
+            default:
+                throw lua_exception("decode can't skip extend type {}", ext);
+            }
+            break;
+        default:
+            throw lua_exception("decode can't skip type {}", type);
+        }
+    }
+
+    inline void typeval_decode(slice* slice, uint8_t type, bool& data);
+    template <std_integer T> requires (!std::same_as<T, bool>)
+    inline void typeval_decode(slice* slice, uint8_t type, T& data);
+    template <std::floating_point T>
+    inline void typeval_decode(slice* slice, uint8_t type, T& data);
+    template <std_string T>
+    inline void typeval_decode(slice* slice, uint8_t type, T& data);
+    template <typename T> requires (std_sequence<T> || std_set<T>)
+    inline void typeval_decode(slice* slice, uint8_t type, T& data);
+    template <std_map T>
+    inline void typeval_decode(slice* slice, uint8_t type, T& data);
+    template <lua_reflected T>
+    inline void typeval_decode(slice* slice, uint8_t type, T& data);
+
+    template <typename T>
+    inline void typeval_decode(slice* slice, T& data) {
+        typeval_decode(slice, slice->read(), data);
+    }
+
+    //兼容整数0/1与lua的boolean
+    inline void typeval_decode(slice* slice, uint8_t type, bool& data) {
+        int64_t val;
+        if (type == type_true || type == type_false) {
+            data = (type == type_true);
+        } else if (typeint_decode(slice, type, val)) {
+            data = (val != 0);
+        } else {
+            typeval_error("boolean", type);
+        }
+    }
+
+    //整数按目标类型检查范围，64位无符号按补码还原
+    template <std_integer T> requires (!std::same_as<T, bool>)
+    inline void typeval_decode(slice* slice, uint8_t type, T& data) {
+        int64_t val;
+        if (!typeint_decode(slice, type, val)) typeval_error("integer", type);
+        using U = typename std::conditional_t<std::is_enum_v<T>, std::underlying_type<T>, std::type_identity<T>>::type;
+        if constexpr (sizeof(U) < sizeof(int64_t) || std::is_signed_v<U>) {
+            if (val < (int64_t)std::numeric_limits<U>::min() || val > (int64_t)std::numeric_limits<U>::max()) {
+                throw lua_exception("decode integer {} is out of range", val);
+            }
+        }
+        data = (T)(U)val;
+    }
+
+    //lua的number可能以整数编码
+    template <std::floating_point T>
+    inline void typeval_decode(slice* slice, uint8_t type, T& data) {
+        int64_t val;
+        if (type == type_number) {
+            data = (T)slice->read<double>();
+        } else if (typeint_decode(slice, type, val)) {
+            data = (T)val;
+        } else {
+            typeval_error("number", type);
+        }
+    }
+
+    template <std_string T>
+    inline void typeval_decode(slice* slice, uint8_t type, T& data) {
+        vstring str;
+        if (!typestr_decode(slice, type, str)) typeval_error("string", type);
+        data = T(str);
+    }
+
+    //读取表的编码，返回ext_array/ext_map/ext_record，其他类型原样返回
+    //type_tab_head按ext_map返回，map的容量指数由exp返回，type_tab_head为0
+    //引用模式的表：去掉定义前缀，原生类型无法共享，不支持引用
+    inline uint8_t typetab_read(slice* slice, uint8_t type, uint8_t* exp = nullptr) {
+        uint8_t* prefix = (type == type_ext) ? slice->peek(1) : nullptr;
+        if (prefix && *prefix == ext_tabref) {
+            throw lua_exception("decode native can't resolve table reference");
+        }
+        if (prefix && *prefix == ext_tabdef) {
+            slice->erase(1);
+            type = slice->read();
+        }
+        if (type == type_tab_head) {
+            if (exp) *exp = 0;
+            return ext_map;
+        }
+        if (type != type_ext) return type;
+        uint8_t ext = slice->read();
+        if (ext == ext_map) {
+            uint8_t hint = slice->read();
+            if (exp) *exp = hint;
+        } else if (ext != ext_array && ext != ext_record) {
+            throw lua_exception("decode extend type {} is invalid", ext);
+        }
+        return ext;
+    }
+
+    inline uint64_t typearray_count(slice* slice) {
+        uint64_t count = slice->read_varint();
+        //每个元素至少1字节，避免按伪造的长度分配
+        if (count > slice->size()) {
+            throw lua_exception("decode array count {} is out of range", count);
+        }
+        return count;
+    }
+
+    template <typename T> requires (std_sequence<T> || std_set<T>)
+    inline void typeval_decode(slice* slice, uint8_t type, T& data) {
+        type = typetab_read(slice, type);
+        if (type != ext_array) typeval_error("array", type);
+        uint64_t count = typearray_count(slice);
+        if constexpr (requires { data.push_back(std::declval<typename T::value_type>()); }) {
+            data.clear();
+            if constexpr (requires { data.reserve(count); }) {
+                data.reserve(count);
+            }
+            for (uint64_t i = 0; i < count; ++i) {
+                typename T::value_type item{};
+                typeval_decode(slice, item);
+                data.push_back(std::move(item));
+            }
+        } else if constexpr (std_set<T>) {
+            data.clear();
+            for (uint64_t i = 0; i < count; ++i) {
+                typename T::value_type item{};
+                typeval_decode(slice, item);
+                data.insert(std::move(item));
+            }
+        } else {
+            //定长数组，个数需一致
+            if (count != data.size()) {
+                throw lua_exception("decode array count {} expect {}", count, data.size());
+            }
+            for (auto& item : data) {
+                typeval_decode(slice, item);
+            }
+        }
+    }
+
+    //lua数组可以解码为整数键的map，空表总是编码为空数组
+    template <std_map T>
+    inline void typeval_decode(slice* slice, uint8_t type, T& data) {
+        data.clear();
+        uint8_t exp = 0;
+        type = typetab_read(slice, type, &exp);
+        if (type == ext_array) {
+            uint64_t count = typearray_count(slice);
+            if constexpr (std_integer<typename T::key_type>) {
+                for (uint64_t i = 1; i <= count; ++i) {
+                    typename T::mapped_type value{};
+                    typeval_decode(slice, value);
+                    data.emplace((typename T::key_type)i, std::move(value));
+                }
+            } else if (count > 0) {
+                typeval_error("map", type);
+            }
+            return;
+        }
+        if (type != ext_map) typeval_error("map", type);
+        if constexpr (requires { data.reserve(0); }) {
+            if (exp > 0) {
+                data.reserve(std::min<size_t>((size_t)1 << std::min(exp, max_size_hint), slice->size() / 2));
+            }
+        }
+        while (true) {
+            uint8_t ktype = slice->read();
+            if (ktype == type_tab_tail) break;
+            typename T::key_type key{};
+            typename T::mapped_type value{};
+            typeval_decode(slice, ktype, key);
+            typeval_decode(slice, value);
+            data.emplace(std::move(key), std::move(value));
+        }
+    }
+
+    //nil字段保留默认值
+    template <typename M>
+    inline void typefield_decode(slice* slice, uint8_t type, M& data) {
+        if (type != type_nil) typeval_decode(slice, type, data);
+    }
+
+    //按字段名匹配，未知字段跳过；ext_record需与lua_reflect<T>::schema一致，按字段顺序解码
+    template <lua_reflected T>
+    inline void typeval_decode(slice* slice, uint8_t type, T& data) {
+        constexpr auto& fields = lua_reflect<T>::fields;
+        type = typetab_read(slice, type);
+        if (type == ext_record) {
+            uint64_t id = slice->read_varint();
+            if constexpr (lua_schema<T>) {
+                if (id == lua_reflect<T>::schema) {
+                    std::apply([&](const auto&... field) {
+                        (typefield_decode(slice, slice->read(), data.*(field.member)), ...);
+                    }, fields);
+                    return;
+                }
+            }
+            throw lua_exception("decode schema {} is mismatch", id);
+        }
+        if (type == ext_array) {
+            if (typearray_count(slice) > 0) typeval_error("struct", type);
+            return;
+        }
+        if (type != ext_map) typeval_error("struct", type);
+        while (true) {
+            uint8_t ktype = slice->read();
+            if (ktype == type_tab_tail) break;
+            vstring name;
+            if (!typestr_decode(slice, ktype, name)) typeval_error("field name", ktype);
+            uint8_t vtype = slice->read();
+            bool found = std::apply([&](const auto&... field) {
+                return ((name == field.name && (typefield_decode(slice, vtype, data.*(field.member)), true)) || ...);
+            }, fields);
+            if (!found) typeval_skip(slice, vtype);
+        }
+    }
+
+    const uint8_t frame_raw     = 0;    //未压缩
+    const uint8_t frame_lz      = 1;    //lz块 + 原始长度(uint32)
+    const size_t lz_threshold   = 1024; //默认压缩阈值
 
     class codec_base {
     public:
         virtual ~codec_base() {};
         virtual int load_packet(size_t data_len) = 0;
         virtual size_t decode(lua_State* L) {
-            return decode_slice(L, m_slice);
+            bool verified = is_verified(m_slice);
+            m_verified = nullptr;
+            return decode_slice(L, unframe(m_slice, verified), m_session.get());
         }
         virtual uint8_t* encode(lua_State* L, int index, size_t* len) {
             int n = lua_gettop(L) - index + 1;
-            slice* slice = encode_slice(L, m_buf, index, n);
-            return slice->data(len);
+            encode_slice(L, m_buf, index, n, m_session.get(), m_refs);
+            return frame(len);
         }
         virtual uint8_t* decode(uint8_t* data, size_t* len) {
             throw lua_exception("decode not implended!");
@@ -522,9 +2205,27 @@ namespace luakit {
         template<typename... Args>
         uint8_t* encode(size_t* len, uint8_t num, Args&&... args) {
             m_buf->clean();
-            value_encode(m_buf, num);
-            (typeval_encode(m_buf, std::forward<Args>(args)), ...);
-            return m_buf->data(len);
+            _encode_args(num, std::forward<Args>(args)...);
+            return frame(len);
+        }
+        //按参数类型直接解码，个数需与编码时一致，出错抛出lua_exception
+        //std::string_view参数指向data或解压缓冲区，在下一次解码之前有效
+        template<typename... Args>
+        void decode(uint8_t* data, size_t len, Args&... args) {
+            slice mslice(data, len);
+            slice* dslice = unframe(&mslice, false);
+            t_sshares.clear();
+            session_scope scope(m_session.get());
+            schema_scope sscope(m_schemas.get());
+            uint8_t argnum = dslice->read();
+            if (argnum != sizeof...(Args)) {
+                throw lua_exception("decode arg num expect {}, but get {}", sizeof...(Args), argnum);
+            }
+            (typeval_decode(dslice, args), ...);
+            if (!dslice->empty()) {
+                throw lua_exception("decode has {} bytes left", dslice->size());
+            }
+            scope.commit();
         }
         virtual void error(const std::string& err) {
             m_err = err;
@@ -541,8 +2242,146 @@ namespace luakit {
         virtual cpchar err() { return m_err.c_str(); }
         virtual size_t get_packet_len() { return m_packet_len; }
         virtual void set_buff(luabuf* buf) { m_buf = buf; }
+        //开启会话字典，连接两端需同时开启，重连时需重新开启
+        void enable_session(size_t slots) {
+            m_session = std::make_unique<session_dict>(slots > 0 ? slots : max_session_slots);
+        }
+        void disable_session() { m_session.reset(); }
+        //开启引用模式：共享的子表只编码一次，支持成环的表
+        void enable_refs() { m_refs = true; }
+        void disable_refs() { m_refs = false; }
+        session_dict* get_session() { return m_session.get(); }
+        //原生解码跳过未知字段中的结构时使用的快照，由注册结构的线程生成，可以在其它线程解码
+        void set_schemas(schema_snapshot_ptr schemas) { m_schemas = std::move(schemas); }
+        //开启压缩，连接两端需同时开启；开启后每帧末尾带1字节标记，不小于threshold的数据尝试压缩
+        void enable_compress(size_t threshold) {
+            m_lz_threshold = threshold > 0 ? threshold : lz_threshold;
+        }
+        void disable_compress() { m_lz_threshold = 0; }
+
+        //开启CRC32C校验，连接两端需同时开启；每帧末尾带4字节校验和，load_packet时校验
+        void enable_checksum() { m_checksum = true; }
+        void disable_checksum() { m_checksum = false; }
+
+        //压缩m_buf中从offset开始的数据，压缩无收益时原样加上标记，返回帧所在的缓冲区
+        //offset非0(批量编码)时压缩结果拷回m_buf
+        luabuf* compress(size_t offset = 0) {
+            if (m_lz_threshold == 0) return m_buf;
+            uint8_t* data = m_buf->head() + offset;
+            size_t len = m_buf->size() - offset;
+            if (len >= m_lz_threshold) {
+                size_t tail = sizeof(uint32_t) + 1;
+                m_zbuf.clean();
+                uint8_t* dest = m_zbuf.peek_space(lz_bound(len) + tail);
+                if (dest) {
+                    size_t zlen = lz_compress(data, len, dest);
+                    if (zlen + tail < len) {
+                        uint32_t raw_len = (uint32_t)len;
+                        memcpy(dest + zlen, &raw_len, sizeof(uint32_t));
+                        dest[zlen + sizeof(uint32_t)] = frame_lz;
+                        m_zbuf.pop_space(zlen + tail);
+                        if (offset == 0) return &m_zbuf;
+                        m_buf->free_place(offset, 0);
+                        m_buf->push_data(dest, zlen + tail);
+                        return m_buf;
+                    }
+                }
+            }
+            m_buf->write<uint8_t>(frame_raw);
+            return m_buf;
+        }
+
+        //编码后的帧处理：压缩，再追加校验和
+        uint8_t* frame(size_t* len, size_t offset = 0) {
+            luabuf* buff = compress(offset);
+            if (m_checksum) {
+                size_t base = (buff == m_buf) ? offset : 0;
+                uint8_t* data = buff->data(len);
+                buff->write<uint32_t>(crc32c(data + base, *len - base));
+            }
+            return buff->data(len);
+        }
+
+        //校验帧尾的CRC32C
+        bool verify(const uint8_t* data, size_t len) {
+            if (!m_checksum) return true;
+            if (len < sizeof(uint32_t)) return false;
+            uint32_t crc;
+            memcpy(&crc, data + len - sizeof(uint32_t), sizeof(uint32_t));
+            return crc32c(data, len - sizeof(uint32_t)) == crc;
+        }
+
+        //slice是否正好是load_packet校验过的包体(去掉包头)
+        bool is_verified(slice* slice) {
+            if (!m_verified || !slice) return false;
+            size_t len = 0;
+            uint8_t* data = slice->data(&len);
+            return data == m_verified && len == m_verified_len;
+        }
+
+        //去掉帧尾的校验和与压缩标记，verified表示load_packet已经校验过
+        slice* unframe(slice* slice, bool verified) {
+            if (m_checksum && slice) {
+                size_t len = slice->size();
+                uint8_t* data = slice->erase(len);
+                if (!verified && !verify(data, len)) {
+                    throw lua_exception("decode frame checksum mismatch");
+                }
+                m_frame.attach(data, len - sizeof(uint32_t));
+                slice = &m_frame;
+            }
+            return uncompress(slice);
+        }
+
+        //按帧标记取出待解码数据，压缩帧直接解压到m_ubuf，原slice被整体消费
+        //解压与编码的压缩使用不同的缓冲区，解码结果不会被之后的编码覆盖
+        slice* uncompress(slice* slice) {
+            if (m_lz_threshold == 0 || !slice) return slice;
+            size_t len = slice->size();
+            uint8_t* data = slice->erase(len);
+            if (len == 0) {
+                throw lua_exception("decode frame flag is missing");
+            }
+            uint8_t flag = data[len - 1];
+            if (flag == frame_raw) {
+                m_frame.attach(data, len - 1);
+                return &m_frame;
+            }
+            size_t tail = sizeof(uint32_t) + 1;
+            if (flag != frame_lz || len < tail) {
+                throw lua_exception("decode frame flag {} is invalid", flag);
+            }
+            uint32_t raw_len;
+            memcpy(&raw_len, data + len - tail, sizeof(uint32_t));
+            m_ubuf.clean();
+            uint8_t* dest = raw_len <= BUFFER_MAX ? m_ubuf.peek_space(raw_len) : nullptr;
+            if (!dest || !lz_decompress(data, len - tail, dest, raw_len)) {
+                throw lua_exception("decode frame decompress failed");
+            }
+            m_ubuf.pop_space(raw_len);
+            return m_ubuf.get_slice();
+        }
 
     protected:
+        template<typename... Args>
+        void _encode_args(uint8_t num, Args&&... args) {
+            t_sindex.clear();
+            session_scope scope(m_session.get());
+            value_encode(m_buf, num);
+            (typeval_encode(m_buf, std::forward<Args>(args)), ...);
+            scope.commit();
+        }
+
+        std::unique_ptr<session_dict> m_session;
+        schema_snapshot_ptr m_schemas;
+        size_t m_lz_threshold = 0;
+        bool m_checksum = false;
+        bool m_refs = false;
+        uint8_t* m_verified = nullptr;  //load_packet校验过的包体，set_slice之后decode时不再重复校验
+        size_t m_verified_len = 0;
+        luabuf m_zbuf;              //压缩后的帧
+        luabuf m_ubuf;              //解压后的数据
+        slice m_frame;
         bool m_failed = false;
         luabuf* m_buf = nullptr;
         slice* m_slice = nullptr;
@@ -550,22 +2389,128 @@ namespace luakit {
         std::string m_err = "";
     };
 
+    //读取包头，环形缓冲区的包头可能跨过回绕点
+    template <arithmetic T>
+    inline bool peek_header(slice* slice, T* val, size_t offset = 0) {
+        uint8_t* data = slice->peek(sizeof(T), offset);
+        if (!data) return false;
+        memcpy(val, data, sizeof(T));
+        return true;
+    }
+
+    template <arithmetic T>
+    inline bool peek_header(ring_buf* ring, T* val, size_t offset = 0) {
+        return ring->peek_value(val, offset);
+    }
+
     class luacodec : public codec_base {
     public:
+        using codec_base::encode;
+
+        //直接从环形缓冲区检查完整包，取包时再用get_slice
+        int load_packet(ring_buf* ring) {
+            uint32_t packet_len = 0;
+            if (!peek_header(ring, &packet_len)) return 0;
+            m_packet_len = packet_len;
+            if (m_packet_len > 0xffffff || m_packet_len < sizeof(uint32_t)) return -1;
+            if (m_packet_len > ring->size()) return 0;
+            if (!verify_packet(ring->peek_data(m_packet_len))) return -1;
+            return m_packet_len;
+        }
+
         virtual int load_packet(size_t data_len) {
             if (!m_slice) return 0;
             uint32_t* packet_len = (uint32_t*)m_slice->peek(sizeof(uint32_t));
             if (!packet_len) return 0;
             m_packet_len = *packet_len;
-            if (m_packet_len > 0xffffff) return -1;
+            if (m_packet_len > 0xffffff || m_packet_len < sizeof(uint32_t)) return -1;
             if (m_packet_len > data_len) return 0;
             if (!m_slice->peek(m_packet_len)) return 0;
+            if (!verify_packet(m_slice->peek(m_packet_len))) return -1;
             return m_packet_len;
         }
 
+        //包体(跳过4字节包头)在解码前校验，失败按错误包处理
+        bool verify_packet(uint8_t* packet) {
+            m_verified = nullptr;
+            if (!m_checksum) return true;
+            if (!packet || m_packet_len < sizeof(uint32_t) * 2) return false;
+            if (!verify(packet + sizeof(uint32_t), m_packet_len - sizeof(uint32_t))) return false;
+            m_verified = packet + sizeof(uint32_t);
+            m_verified_len = m_packet_len - sizeof(uint32_t);
+            return true;
+        }
+
         virtual uint8_t* encode(lua_State* L, int index, size_t* len) {
-            slice* slice = encode_slice(L, m_buf, index, 1);
-            return slice->data(len);
+            encode_slice(L, m_buf, index, 1, m_session.get(), m_refs);
+            return frame(len);
+        }
+
+        //批量编码：多条消息追加到同一个缓冲区，每条带4字节包头(包头计入长度)，与load_packet一致
+        //每条消息单独压缩和校验，会话字典按消息顺序提交
+        void batch_begin() {
+            m_buf->clean();
+            m_batch.clear();
+        }
+
+        //追加一条消息，返回包头在缓冲区中的偏移
+        size_t batch_encode(lua_State* L, int index, int num) {
+            size_t base = _batch_head();
+            encode_append(L, m_buf, index, num, m_session.get(), m_refs);
+            return _batch_tail(base);
+        }
+
+        template<typename... Args>
+        size_t batch_encode(uint8_t num, Args&&... args) {
+            size_t base = _batch_head();
+            _encode_args(num, std::forward<Args>(args)...);
+            return _batch_tail(base);
         }
+
+        uint8_t* batch_data(size_t* len) { return m_buf->data(len); }
+        const std::vector<size_t>& batch_offsets() { return m_batch; }
+
+        //批量解码：在slice上循环load_packet，每个完整的包以包体调用handler(slice*)
+        //handler中可以调用decode(L)解码当前包；不完整的包留在slice中，返回处理的包数，错误包返回-1
+        template <typename F>
+        int batch_decode(slice* slice, F&& handler) {
+            int count = 0;
+            while (!slice->empty()) {
+                set_slice(slice);
+                int len = load_packet(slice->size());
+                if (len == 0) break;
+                //包长必须包含包头，否则包体长度回绕或者停在原地
+                if (len < (int)sizeof(uint32_t)) {
+                    set_slice(nullptr);
+                    return -1;
+                }
+                uint8_t* packet = slice->erase(len);
+                m_packet.attach(packet + sizeof(uint32_t), len - sizeof(uint32_t));
+                set_slice(&m_packet);
+                handler(&m_packet);
+                count++;
+            }
+            set_slice(nullptr);
+            return count;
+        }
+
+    protected:
+        size_t _batch_head() {
+            size_t base = m_buf->size();
+            m_buf->write<uint32_t>(0);
+            return base;
+        }
+
+        size_t _batch_tail(size_t base) {
+            size_t len = 0;
+            frame(&len, base + sizeof(uint32_t));
+            uint32_t packet_len = (uint32_t)(len - base);
+            m_buf->copy(base, (cpbyte)&packet_len, sizeof(uint32_t));
+            m_batch.push_back(base);
+            return base;
+        }
+
+        std::vector<size_t> m_batch;
+        slice m_packet;
     };
 }
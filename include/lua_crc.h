@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+
+#include "lua_base.h"
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace luakit {
+
+    const uint32_t CRC32C_POLY = 0x82F63B78;    //Castagnoli，反射形式
+
+    //slicing-by-8查表，没有crc指令时使用
+    using crc_table = std::array<std::array<uint32_t, 256>, 8>;
+
+    constexpr crc_table crc32c_make_table() {
+        crc_table table = {};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; ++j) {
+                crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (size_t k = 1; k < 8; ++k) {
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+            }
+        }
+        return table;
+    }
+
+    inline constexpr crc_table crc32c_table = crc32c_make_table();
+
+    inline uint32_t crc32c_soft(uint32_t crc, const uint8_t* data, size_t len) {
+        while (len >= 8) {
+            uint64_t val;
+            memcpy(&val, data, sizeof(val));
+            val ^= crc;
+            crc = crc32c_table[7][val & 0xff] ^ crc32c_table[6][(val >> 8) & 0xff] ^
+                  crc32c_table[5][(val >> 16) & 0xff] ^ crc32c_table[4][(val >> 24) & 0xff] ^
+                  crc32c_table[3][(val >> 32) & 0xff] ^ crc32c_table[2][(val >> 40) & 0xff] ^
+                  crc32c_table[1][(val >> 48) & 0xff] ^ crc32c_table[0][val >> 56];
+            data += 8;
+            len -= 8;
+        }
+        while (len-- > 0) {
+            crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *data++) & 0xff];
+        }
+        return crc;
+    }
+
+#ifdef LUAKIT_SIMD_X64
+    //按函数开启SSE4.2，调用前需检测cpu支持
+    LUAKIT_TARGET("sse4.2") inline uint32_t crc32c_sse42(uint32_t crc, const uint8_t* data, size_t len) {
+        uint64_t crc64 = crc;
+        while (len >= 8) {
+            uint64_t val;
+            memcpy(&val, data, sizeof(val));
+            crc64 = _mm_crc32_u64(crc64, val);
+            data += 8;
+            len -= 8;
+        }
+        crc = (uint32_t)crc64;
+        while (len-- > 0) {
+            crc = _mm_crc32_u8(crc, *data++);
+        }
+        return crc;
+    }
+#endif
+
+    //CRC32C，支持分段累加：crc32c(b, crc32c(a)) == crc32c(a + b)
+    //x86-64运行时检测SSE4.2，ARMv8编译时开启crc时使用crc指令，否则查表
+    inline uint32_t crc32c(const uint8_t* data, size_t len, uint32_t crc = 0) {
+        crc = ~crc;
+#if defined(LUAKIT_SIMD_X64)
+        crc = cpu_support().sse42 ? crc32c_sse42(crc, data, len) : crc32c_soft(crc, data, len);
+#elif defined(__ARM_FEATURE_CRC32)
+        while (len >= 8) {
+            uint64_t val;
+            memcpy(&val, data, sizeof(val));
+            crc = __crc32cd(crc, val);
+            data += 8;
+            len -= 8;
+        }
+        while (len-- > 0) {
+            crc = __crc32cb(crc, *data++);
+        }
+#else
+        crc = crc32c_soft(crc, data, len);
+#endif
+        return ~crc;
+    }
+}
@@ -0,0 +1,635 @@
+#pragma once
+
+#include <cmath>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+
+#include "lua_codec.h"
+
+namespace luakit {
+
+    const size_t max_dom_depth      = 64;
+    const size_t max_dom_threads    = 16;
+
+    //DOM中的值，整数统一为type_int64，字符串统一为type_string32，表统一为type_tab_head，引用已有的表为type_ext
+    struct dom_value {
+        uint8_t type;
+        union {
+            int64_t ival;
+            double nval;
+            uint32_t node;      //表(type_tab_head/type_ext)的节点序号
+            uint32_t sid;       //字符串在去重后的字符串表中的序号
+        };
+    };
+
+    //去重后的字符串，多次出现的在物化时只创建一次
+    struct dom_string {
+        uint32_t off;           //相对于数据起始位置
+        uint32_t len;
+        uint32_t uses = 0;
+    };
+
+    struct dom_node {
+        uint8_t type;           //ext_array/ext_map/ext_record
+        bool shared = false;    //引用模式下被引用的表，物化时登记
+        uint32_t first = 0;     //在values中的起始位置，map按键值对存放
+        uint32_t count = 0;     //元素个数，map为键值对个数
+        uint32_t narr = 0;      //lua_createtable的预分配大小
+        uint32_t nrec = 0;
+        uint32_t schema = 0;    //结构在m_schema_ids中的序号
+    };
+
+    //两阶段解码：parse把编码数据解析为DOM，不访问lua_State和线程局部的编解码状态，可以在任意线程执行
+    //materialize在lua线程按DOM创建lua值，表按解析时统计的大小精确预分配
+    //字符串指向源数据，物化完成前源数据需保持有效
+    //不支持会话字典模式，支持引用模式
+    class dom_doc {
+    public:
+        //schemas为结构字段数快照，为空时数据中不能有结构
+        void parse(const uint8_t* data, size_t len, const schema_fields* schemas = nullptr) {
+            clear();
+            m_data = data;
+            m_len = len;
+            m_schemas = schemas;
+            uint8_t argnum = _read<uint8_t>();
+            for (uint8_t i = 0; i < argnum; ++i) {
+                m_args.push_back(_value(0));
+            }
+            if (m_pos != m_len) {
+                throw lua_exception("dom decode has {} bytes left", m_len - m_pos);
+            }
+        }
+
+        //压入解码出的参数，返回个数
+        //结构元表、多次出现的字符串、引用的表先放在参数下方，完成后移除
+        int materialize(lua_State* L) {
+            int base = lua_gettop(L);
+            luaL_checkstack(L, (int)(m_args.size() + m_schema_ids.size() * 2) + 4, "dom materialize too many results");
+            m_schema_base = base + 1;
+            for (size_t i = 0; i < m_schema_ids.size(); ++i) {
+                _schema(L, m_schema_ids[i], m_schema_counts[i]);
+            }
+            m_strs = 0;
+            if (m_multi > 0) {
+                lua_createtable(L, (int)m_strings.size(), 0);
+                m_strs = lua_gettop(L);
+                for (uint32_t sid = 0; sid < m_strings.size(); ++sid) {
+                    const dom_string& s = m_strings[sid];
+                    if (s.uses < 2) continue;
+                    lua_pushlstring(L, (cpchar)m_data + s.off, s.len);
+                    lua_rawseti(L, m_strs, sid + 1);
+                }
+            }
+            int refs = 0;
+            if (m_shared) {
+                lua_createtable(L, (int)m_nodes.size(), 0);
+                refs = lua_gettop(L);
+            }
+            int nprefix = lua_gettop(L) - base;
+            for (auto& value : m_args) {
+                _push(L, value, refs);
+            }
+            int nargs = (int)m_args.size();
+            if (nprefix > 0) {
+                lua_rotate(L, base + 1, nargs);
+                lua_settop(L, base + nargs);
+            }
+            return nargs;
+        }
+
+        void clear() {
+            m_pos = 0;
+            m_tabdef = false;
+            m_shared = false;
+            m_args.clear();
+            m_refs.clear();
+            m_nodes.clear();
+            m_stack.clear();
+            m_values.clear();
+            m_shares.clear();
+            m_sids.clear();
+            m_strings.clear();
+            m_schema_ids.clear();
+            m_schema_counts.clear();
+            m_multi = 0;
+        }
+
+    protected:
+        template <typename T>
+        T _read() {
+            if (m_len - m_pos < sizeof(T)) {
+                throw lua_exception("dom decode data is out of range");
+            }
+            T val;
+            memcpy(&val, m_data + m_pos, sizeof(T));
+            m_pos += sizeof(T);
+            return val;
+        }
+
+        uint64_t _varint() {
+            uint64_t val = 0;
+            size_t n = varint_decode(m_data + m_pos, m_len - m_pos, &val);
+            if (n == 0) {
+                throw lua_exception("dom decode varint is invalid");
+            }
+            m_pos += n;
+            return val;
+        }
+
+        dom_value _string(size_t sz) {
+            if (sz > max_string_size || m_len - m_pos < sz) {
+                throw lua_exception("dom decode string is out of range");
+            }
+            dom_value value{ type_string32, {} };
+            auto [it, inserted] = m_sids.try_emplace(vstring((cpchar)m_data + m_pos, sz), (uint32_t)m_strings.size());
+            if (inserted) m_strings.push_back({ (uint32_t)m_pos, (uint32_t)sz });
+            value.sid = it->second;
+            _use(value.sid);
+            m_pos += sz;
+            return value;
+        }
+
+        void _use(uint32_t sid) {
+            if (++m_strings[sid].uses == 2) m_multi++;
+        }
+
+        dom_value _integer(int64_t val) {
+            dom_value value{ type_int64, {} };
+            value.ival = val;
+            return value;
+        }
+
+        dom_value _value(size_t depth) {
+            uint8_t type = _read<uint8_t>();
+            if (m_tabdef && type != type_tab_head && !(type == type_ext && m_pos < m_len && ext_table(m_data[m_pos]))) {
+                throw lua_exception("dom decode table define has type {}", type);
+            }
+            dom_value value{ type, {} };
+            switch (type) {
+            case type_nil:
+            case type_true:
+            case type_false:
+            case type_undefine:
+                return value;
+            case type_number:
+                value.nval = _read<double>();
+                return value;
+            case type_int16:
+                return _integer(_read<int16_t>());
+            case type_int32:
+                return _integer(_read<int32_t>());
+            case type_int64:
+                return _integer(_read<int64_t>());
+            case type_string8:
+                return _string(_read<uint8_t>());
+            case type_string16:
+                return _string(_read<uint16_t>());
+            case type_string32:
+                return _string(_read<uint32_t>());
+            case type_istring:
+                value = _string(_read<uint8_t>());
+                m_shares.push_back(value);
+                return value;
+            case type_strindex: {
+                uint8_t index = _read<uint8_t>();
+                if (index >= m_shares.size()) {
+                    throw lua_exception("dom decode string index is out of range");
+                }
+                _use(m_shares[index].sid);
+                return m_shares[index];
+            }
+            case type_tab_head:
+                value.node = _map(depth);
+                return value;
+            case type_ext:
+                value.type = type_tab_head;
+                switch (uint8_t ext = _read<uint8_t>()) {
+                case ext_map:
+                    _read<uint8_t>();
+                    value.node = _map(depth);
+                    return value;
+                case ext_array:
+                    value.node = _array(depth);
+                    return value;
+                case ext_record:
+                    value.node = _record(depth);
+                    return value;
+                case ext_tabdef:
+                    m_tabdef = true;
+                    return _value(depth);
+                case ext_tabref: {
+                    uint64_t index = _varint();
+                    if (index >= m_refs.size()) {
+                        throw lua_exception("dom decode table reference {} is out of range", index);
+                    }
+                    value.type = type_ext;
+                    value.node = m_refs[index];
+                    return value;
+                }
+                default:
+                    throw lua_exception("dom decode extend type {} is invalid", ext);
+                }
+            }
+            return _integer(type - type_max);
+        }
+
+        uint32_t _open(uint8_t type, size_t depth) {
+            if (depth >= max_dom_depth) {
+                throw lua_exception("dom decode table is too depth");
+            }
+            uint32_t id = (uint32_t)m_nodes.size();
+            m_nodes.push_back({ type });
+            if (m_tabdef) {
+                m_nodes[id].shared = true;
+                m_shared = true;
+                m_refs.push_back(id);
+                m_tabdef = false;
+            }
+            return id;
+        }
+
+        //子表的值先出栈，每个表的值在values中连续存放
+        uint32_t _close(uint32_t id, size_t base) {
+            dom_node& n = m_nodes[id];
+            n.first = (uint32_t)m_values.size();
+            m_values.insert(m_values.end(), m_stack.begin() + base, m_stack.end());
+            m_stack.resize(base);
+            return id;
+        }
+
+        uint32_t _map(size_t depth) {
+            uint32_t id = _open(ext_map, depth);
+            size_t base = m_stack.size();
+            while (true) {
+                if (m_pos >= m_len) {
+                    throw lua_exception("dom decode data is out of range");
+                }
+                if (m_data[m_pos] == type_tab_tail) {
+                    m_pos++;
+                    break;
+                }
+                dom_value key = _value(depth + 1);
+                if (key.type == type_nil || (key.type == type_number && std::isnan(key.nval))) {
+                    throw lua_exception("dom decode table key is invalid");
+                }
+                dom_value value = _value(depth + 1);
+                //nil值不会写入lua表
+                if (value.type == type_nil) continue;
+                m_stack.push_back(key);
+                m_stack.push_back(value);
+            }
+            //[1, count]内的整数键进数组部分，其余进哈希部分
+            uint32_t count = (uint32_t)(m_stack.size() - base) / 2;
+            uint32_t narr = 0, nhit = 0;
+            for (size_t i = base; i < m_stack.size(); i += 2) {
+                dom_value& key = m_stack[i];
+                if (key.type == type_int64 && key.ival >= 1 && key.ival <= count) narr++;
+            }
+            for (size_t i = base; i < m_stack.size(); i += 2) {
+                dom_value& key = m_stack[i];
+                if (key.type == type_int64 && key.ival >= 1 && key.ival <= narr) nhit++;
+            }
+            dom_node& n = m_nodes[id];
+            n.count = count;
+            n.narr = narr;
+            n.nrec = count - nhit;
+            return _close(id, base);
+        }
+
+        uint32_t _array(size_t depth) {
+            uint32_t id = _open(ext_array, depth);
+            uint64_t count = _varint();
+            //每个元素至少1字节，避免按伪造的长度分配
+            if (count > m_len - m_pos) {
+                throw lua_exception("dom decode array count {} is out of range", count);
+            }
+            size_t base = m_stack.size();
+            for (uint64_t i = 0; i < count; ++i) {
+                m_stack.push_back(_value(depth + 1));
+            }
+            dom_node& n = m_nodes[id];
+            n.count = n.narr = (uint32_t)count;
+            return _close(id, base);
+        }
+
+        uint32_t _record(size_t depth) {
+            uint32_t id = _open(ext_record, depth);
+            uint64_t schema = _varint();
+            if (!m_schemas || schema > UINT32_MAX) {
+                throw lua_exception("dom decode schema {} is not registered", schema);
+            }
+            auto it = m_schemas->find((uint32_t)schema);
+            if (it == m_schemas->end()) {
+                throw lua_exception("dom decode schema {} is not registered", schema);
+            }
+            uint32_t count = it->second;
+            if (count > m_len - m_pos) {
+                throw lua_exception("dom decode schema {} is out of range", schema);
+            }
+            size_t base = m_stack.size();
+            uint32_t nrec = 0;
+            for (uint32_t i = 0; i < count; ++i) {
+                m_stack.push_back(_value(depth + 1));
+                if (m_stack.back().type != type_nil) nrec++;
+            }
+            auto slot = std::find(m_schema_ids.begin(), m_schema_ids.end(), (uint32_t)schema);
+            if (slot == m_schema_ids.end()) {
+                slot = m_schema_ids.insert(slot, (uint32_t)schema);
+                m_schema_counts.push_back(count);
+            }
+            dom_node& n = m_nodes[id];
+            n.schema = (uint32_t)(slot - m_schema_ids.begin());
+            n.count = count;
+            n.nrec = nrec;
+            return _close(id, base);
+        }
+
+        void _push(lua_State* L, const dom_value& value, int refs) {
+            switch (value.type) {
+            case type_nil:
+                lua_pushnil(L);
+                break;
+            case type_true:
+                lua_pushboolean(L, true);
+                break;
+            case type_false:
+                lua_pushboolean(L, false);
+                break;
+            case type_number:
+                lua_pushnumber(L, value.nval);
+                break;
+            case type_int64:
+                lua_pushinteger(L, value.ival);
+                break;
+            case type_string32:
+                if (m_strs && m_strings[value.sid].uses > 1) {
+                    lua_rawgeti(L, m_strs, value.sid + 1);
+                } else {
+                    lua_pushlstring(L, (cpchar)m_data + m_strings[value.sid].off, m_strings[value.sid].len);
+                }
+                break;
+            case type_undefine:
+                lua_pushstring(L, "undefine");
+                break;
+            case type_ext:
+                lua_rawgeti(L, refs, value.node);
+                break;
+            case type_tab_head:
+                _table(L, value.node, refs);
+                break;
+            }
+        }
+
+        //结构在物化开始时校验一次，元表和字段信息表放在栈上
+        void _schema(lua_State* L, uint32_t schema, uint32_t count) {
+            int top = lua_gettop(L);
+            push_schema_registry(L);
+            lua_rawgeti(L, -1, schema);
+            if (!lua_istable(L, -1) || lua_rawgetp(L, -1, &schema_registry) != LUA_TTABLE || lua_rawlen(L, -1) != count) {
+                lua_settop(L, top);
+                throw lua_exception("dom materialize schema {} is changed", schema);
+            }
+            lua_remove(L, top + 1);
+        }
+
+        void _table(lua_State* L, uint32_t id, int refs) {
+            luaL_checkstack(L, 4, "dom materialize too depth");
+            const dom_node& n = m_nodes[id];
+            lua_createtable(L, (int)n.narr, (int)n.nrec);
+            int table = lua_gettop(L);
+            if (n.shared) {
+                lua_pushvalue(L, table);
+                lua_rawseti(L, refs, id);
+            }
+            const dom_value* values = m_values.data() + n.first;
+            switch (n.type) {
+            case ext_array:
+                for (uint32_t i = 0; i < n.count; ++i) {
+                    _push(L, values[i], refs);
+                    lua_rawseti(L, table, i + 1);
+                }
+                break;
+            case ext_map:
+                for (uint32_t i = 0; i < n.count * 2; i += 2) {
+                    //数组部分的整数键直接按序号写入
+                    const dom_value& key = values[i];
+                    if (key.type == type_int64 && key.ival >= 1 && key.ival <= n.narr) {
+                        _push(L, values[i + 1], refs);
+                        lua_rawseti(L, table, key.ival);
+                        continue;
+                    }
+                    _push(L, key, refs);
+                    _push(L, values[i + 1], refs);
+                    lua_rawset(L, table);
+                }
+                break;
+            default: {
+                int meta = m_schema_base + (int)n.schema * 2;
+                for (uint32_t i = 0; i < n.count; ++i) {
+                    if (values[i].type == type_nil) continue;
+                    lua_rawgeti(L, meta + 1, i + 1);
+                    _push(L, values[i], refs);
+                    lua_rawset(L, table);
+                }
+                lua_pushvalue(L, meta);
+                lua_setmetatable(L, table);
+                break;
+            }
+            }
+        }
+
+    private:
+        size_t m_len = 0;
+        size_t m_pos = 0;
+        bool m_tabdef = false;
+        bool m_shared = false;
+        const uint8_t* m_data = nullptr;
+        const schema_fields* m_schemas = nullptr;
+        int m_strs = 0;             //物化时多次出现的字符串表在栈上的位置
+        int m_schema_base = 0;      //物化时结构元表和字段信息表在栈上的起始位置
+        uint32_t m_multi = 0;       //多次出现的字符串个数
+        std::vector<uint32_t> m_schema_ids;
+        std::vector<uint32_t> m_schema_counts;
+        std::vector<dom_string> m_strings;
+        std::unordered_map<vstring, uint32_t> m_sids;
+        std::vector<uint32_t> m_refs;
+        std::vector<dom_node> m_nodes;
+        std::vector<dom_value> m_args;
+        std::vector<dom_value> m_stack;
+        std::vector<dom_value> m_values;
+        std::vector<dom_value> m_shares;
+    };
+
+    //解码任务，源字符串由注册表引用保持，物化完成后释放
+    struct dom_task {
+        uint32_t id = 0;
+        int ref = LUA_NOREF;
+        size_t len = 0;
+        const uint8_t* data = nullptr;
+        schema_snapshot_ptr schemas;
+        std::string err;
+        dom_doc doc;
+    };
+
+    //解码线程池：submit在lua线程提交数据，工作线程parse，poll/wait在lua线程取回结果并物化
+    class dom_pool {
+    public:
+        dom_pool(lua_State* L, size_t threads) {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+            m_L = lua_tothread(L, -1);
+            lua_pop(L, 1);
+            threads = std::clamp<size_t>(threads, 1, max_dom_threads);
+            for (size_t i = 0; i < threads; ++i) {
+                m_threads.emplace_back([this] { _run(); });
+            }
+        }
+        ~dom_pool() {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cond.notify_all();
+            for (auto& thread : m_threads) {
+                thread.join();
+            }
+            _release();
+            for (auto& task : m_tasks) {
+                luaL_unref(m_L, LUA_REGISTRYINDEX, task->ref);
+            }
+            for (auto& task : m_done) {
+                luaL_unref(m_L, LUA_REGISTRYINDEX, task->ref);
+            }
+        }
+        dom_pool(const dom_pool&) = delete;
+        dom_pool& operator =(const dom_pool&) = delete;
+
+        //由lua管理生命周期
+        void __gc() { delete this; }
+
+        //已提交未取回的任务数
+        size_t pending() {
+            return m_pending;
+        }
+
+        //lua: submit(data)，返回任务id
+        int lua_submit(lua_State* L) {
+            size_t len = 0;
+            cpchar data = luaL_checklstring(L, 1, &len);
+            _snapshot(L);
+            auto task = std::make_unique<dom_task>();
+            task->id = ++m_serial;
+            task->len = len;
+            task->data = (const uint8_t*)data;
+            task->schemas = m_schemas;
+            lua_pushvalue(L, 1);
+            task->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_tasks.push_back(std::move(task));
+            }
+            m_cond.notify_one();
+            m_pending++;
+            lua_pushinteger(L, m_serial);
+            return 1;
+        }
+
+        //lua: poll()，取回一个已解析的任务：id, true, ...或id, false, err，没有时不返回
+        int lua_poll(lua_State* L) {
+            return _collect(L, false);
+        }
+
+        //lua: wait()，同poll，没有已解析的任务时等待
+        int lua_wait(lua_State* L) {
+            return _collect(L, true);
+        }
+
+    protected:
+        void _run() {
+            while (true) {
+                std::unique_ptr<dom_task> task;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cond.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+                    if (m_stop) return;
+                    task = std::move(m_tasks.front());
+                    m_tasks.pop_front();
+                }
+                try {
+                    task->doc.parse(task->data, task->len, task->schemas.get());
+                } catch (const std::exception& e) {
+                    task->err = e.what();
+                }
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_done.push_back(std::move(task));
+                }
+                m_done_cond.notify_one();
+            }
+        }
+
+        //结构注册有变化时重建快照，已提交的任务继续使用旧快照
+        void _snapshot(lua_State* L) {
+            if (m_schemas && m_version == t_schema_version) return;
+            m_schemas = schema_snapshot(L);
+            m_version = t_schema_version;
+        }
+
+        //物化中的任务保存在m_ready中，lua报错时也能在下次取回或析构时释放
+        void _release() {
+            if (m_ready) {
+                luaL_unref(m_L, LUA_REGISTRYINDEX, m_ready->ref);
+                m_ready.reset();
+            }
+        }
+
+        int _collect(lua_State* L, bool wait) {
+            _release();
+            if (m_pending == 0) return 0;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (wait) {
+                    m_done_cond.wait(lock, [this] { return !m_done.empty(); });
+                } else if (m_done.empty()) {
+                    return 0;
+                }
+                m_ready = std::move(m_done.front());
+                m_done.pop_front();
+            }
+            m_pending--;
+            int top = lua_gettop(L);
+            lua_pushinteger(L, m_ready->id);
+            if (m_ready->err.empty()) {
+                lua_pushboolean(L, true);
+                try {
+                    m_ready->doc.materialize(L);
+                } catch (const std::exception& e) {
+                    m_ready->err = e.what();
+                    lua_settop(L, top + 1);
+                }
+            }
+            if (!m_ready->err.empty()) {
+                lua_pushboolean(L, false);
+                lua_pushstring(L, m_ready->err.c_str());
+            }
+            int nresults = lua_gettop(L) - top;
+            _release();
+            return nresults;
+        }
+
+    private:
+        bool m_stop = false;
+        uint32_t m_serial = 0;
+        uint32_t m_version = 0;
+        size_t m_pending = 0;
+        lua_State* m_L = nullptr;
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::condition_variable m_done_cond;
+        std::vector<std::thread> m_threads;
+        std::unique_ptr<dom_task> m_ready;
+        schema_snapshot_ptr m_schemas;
+        std::deque<std::unique_ptr<dom_task>> m_tasks;
+        std::deque<std::unique_ptr<dom_task>> m_done;
+    };
+}
@@ -4,7 +4,12 @@
 
 #include "lua_buff.h"
 #include "lua_time.h"
+#include "lua_chain.h"
+#include "lua_mmap.h"
 #include "lua_codec.h"
+#include "lua_stream.h"
+#include "lua_lazy.h"
+#include "lua_dom.h"
 #include "lua_table.h"
 #include "lua_class.h"
 #include "lua_logger.h"
@@ -52,14 +57,59 @@ namespace luakit {
             lua_getglobal(L, "luakit");
             if (lua_isnil(L, -1)) {
                 new_class<kit_state>();
-                new_class<codec_base>();
+                new_class<codec_base>(
+                    "enable_session", &codec_base::enable_session,
+                    "disable_session", &codec_base::disable_session,
+                    "enable_compress", &codec_base::enable_compress,
+                    "disable_compress", &codec_base::disable_compress,
+                    "enable_checksum", &codec_base::enable_checksum,
+                    "disable_checksum", &codec_base::disable_checksum,
+                    "enable_refs", &codec_base::enable_refs,
+                    "disable_refs", &codec_base::disable_refs
+                );
                 new_class<class_member>();
                 new_class<function_wrapper>();
                 new_class<slice>(
                     "size", &slice::size,
                     "recv", &slice::recv,
                     "peek", &slice::check,
-                    "string", &slice::string
+                    "string", &slice::string,
+                    "view", &slice::view,
+                    "peek_view", &slice::peek_view,
+                    "recv_view", &slice::recv_view,
+                    "read_array", &slice::unpack_array,
+                    "varint", &slice::varint,
+                    "zigzag", &slice::zigzag,
+                    "varints", &slice::varints
+                );
+                new_class<mapped_slice>(
+                    "size", &slice::size,
+                    "recv", &slice::recv,
+                    "peek", &slice::check,
+                    "string", &slice::string,
+                    "view", &slice::view,
+                    "peek_view", &slice::peek_view,
+                    "recv_view", &slice::recv_view,
+                    "read_array", &slice::unpack_array,
+                    "varint", &slice::varint,
+                    "zigzag", &slice::zigzag,
+                    "varints", &slice::varints,
+                    "close", &mapped_slice::close,
+                    "rewind", &mapped_slice::rewind,
+                    "file_size", &mapped_slice::file_size
+                );
+                new_class<stream_decoder>(
+                    "feed", &stream_decoder::lua_feed,
+                    "results", &stream_decoder::lua_results,
+                    "reset", &stream_decoder::reset,
+                    "pending", &stream_decoder::pending,
+                    "err", &stream_decoder::err
+                );
+                new_class<dom_pool>(
+                    "submit", &dom_pool::lua_submit,
+                    "poll", &dom_pool::lua_poll,
+                    "wait", &dom_pool::lua_wait,
+                    "pending", &dom_pool::pending
                 );
                 luakit_extendlibs(this);
                 lua_checkstack(L, 1024);
@@ -68,7 +118,44 @@ namespace luakit {
                 luakit.set_function("next_id", [&]() { return ++m_serial32; });
                 luakit.set_function("next_id64", [&]() { return ++m_serial64; });
                 luakit.set_function("encode", [&](lua_State* L) { return encode(L, &lbuf); });
+                luakit.set_function("encode_refs", [&](lua_State* L) { return encode(L, &lbuf, true); });
                 luakit.set_function("decode", [&](lua_State* L) { return decode(L, &lbuf); });
+                luakit.set_function("decode_lazy", lua_decode_lazy);
+                luakit.set_function("materialize", lua_materialize);
+                luakit.set_function("decode_slice", [&](lua_State* L) { return decode(L, lua_to_object<slice*>(L, 1)); });
+                luakit.set_function("mmap", [](lua_State* L) {
+                    cpchar path = luaL_checkstring(L, 1);
+                    mapped_slice* mslice = mmap_file(path);
+                    if (!mslice) return luaL_error(L, "mmap %s failed", path);
+                    lua_push_object(L, mslice);
+                    return 1;
+                });
+                luakit.set_function("pack_array", [&](lua_State* L) { return pack_array(L, &lbuf); });
+                luakit.set_function("pack_varints", [&](lua_State* L) { return pack_varints(L, &lbuf); });
+                luakit.set_function("buff_stats", [&](lua_State* L) { return lua_buff_stats(L, &lbuf); });
+                luakit.set_function("pool_trim", [](lua_State* L) {
+                    size_pool* pool = thread_pool();
+                    lua_pushinteger(L, pool ? pool->trim(luaL_optinteger(L, 1, 0)) : 0);
+                    return 1;
+                });
+                luakit.set_function("pool_budget", [](lua_State* L) {
+                    size_pool* pool = thread_pool();
+                    if (pool) pool->set_budget(luaL_checkinteger(L, 1));
+                    return 0;
+                });
+                luakit.set_function("schema", lua_new_schema);
+                luakit.set_function("compress", [&](lua_State* L) { return lua_compress(L, &lbuf); });
+                luakit.set_function("decompress", [&](lua_State* L) { return lua_decompress(L, &lbuf); });
+                //lua: stream_decoder(session)，session为true表示数据来自会话字典模式的连接
+                luakit.set_function("stream_decoder", [](lua_State* L) {
+                    lua_push_object(L, new stream_decoder(L, lua_toboolean(L, 1)));
+                    return 1;
+                });
+                luakit.set_function("dom_pool", [](lua_State* L) {
+                    size_t threads = (size_t)luaL_optinteger(L, 1, std::max(std::thread::hardware_concurrency(), 2u) - 1);
+                    lua_push_object(L, new dom_pool(L, threads));
+                    return 1;
+                });
             }
         }
 
@@ -214,6 +301,33 @@ namespace luakit {
             return table;
         }
 
+        //注册结构，返回结构元表的引用
+        reference new_schema(uint32_t id, std::initializer_list<cpchar> fields) {
+            lua_guard g(m_L);
+            lua_createtable(m_L, (int)fields.size(), 0);
+            int i = 0;
+            for (cpchar field : fields) {
+                lua_pushstring(m_L, field);
+                lua_rawseti(m_L, -2, ++i);
+            }
+            schema_register(m_L, id, -1, 0);
+            return reference(m_L);
+        }
+
+        //按lua_reflect<T>注册结构，已注册时检查字段顺序
+        template <lua_schema T>
+        reference new_schema() {
+            lua_guard g(m_L);
+            schema_register<T>(m_L);
+            return reference(m_L);
+        }
+
+        //已注册结构的快照，交给其它线程的codec用于原生解码
+        schema_snapshot_ptr schema_snapshot() {
+            lua_guard g(m_L);
+            return luakit::schema_snapshot(m_L);
+        }
+
         template<typename T, typename... arg_types>
         void new_class(arg_types... args) {
             lua_wrap_class<T>(m_L, std::forward<arg_types>(args)...);
@@ -0,0 +1,660 @@
+#pragma once
+
+#include <cmath>
+
+#include "lua_codec.h"
+
+namespace luakit {
+
+    const cpchar LAZY_META = "luakit.lazy";
+    const cpchar LAZY_DOC_META = "luakit.lazy_doc";
+
+    const uint32_t lazy_none        = UINT32_MAX;
+    const size_t lazy_hash_min      = 16;   //超过该个数的表首次按字符串查找时建立键索引
+    const size_t max_lazy_depth     = 64;
+
+    //结构索引项，偏移相对于数据起始位置
+    struct lazy_entry {
+        uint32_t key;       //键token的偏移，数组和结构为lazy_none
+        uint32_t value;     //值token的偏移
+        uint32_t key_node;  //键为表时的节点
+        uint32_t node;      //值为表时的节点
+    };
+
+    struct lazy_node {
+        uint8_t type;       //ext_map/ext_array/ext_record
+        uint32_t first = 0; //在entries中的起始位置
+        uint32_t count = 0;
+        uint32_t schema = 0;
+    };
+
+    //延迟解码的文档：持有源字符串，一次遍历建立所有表的结构索引，不创建lua对象
+    //不支持会话字典模式，支持引用模式
+    class lazy_doc {
+    public:
+        void build(lua_State* L, cpchar data, size_t len) {
+            m_data = (const uint8_t*)data;
+            m_len = len;
+            m_pos = 0;
+            uint8_t argnum = _read<uint8_t>();
+            for (uint8_t i = 0; i < argnum; ++i) {
+                uint32_t value = (uint32_t)m_pos;
+                uint32_t node = _value(L, 0);
+                m_args.push_back({ lazy_none, value, lazy_none, node });
+            }
+            if (m_pos != m_len) {
+                throw lua_exception("lazy decode has {} bytes left", m_len - m_pos);
+            }
+        }
+
+        size_t argnum() { return m_args.size(); }
+        lazy_entry& arg(size_t i) { return m_args[i]; }
+        lazy_node& node(uint32_t i) { return m_nodes[i]; }
+        lazy_entry& entry(const lazy_node& n, size_t i) { return m_entries[n.first + i]; }
+
+        //读取字符串token
+        bool string_at(uint32_t off, vstring& str) {
+            uint8_t type = m_data[off];
+            cpchar ptr = (cpchar)m_data + off + 1;
+            switch (type) {
+            case type_string8:
+            case type_istring:
+                str = vstring(ptr + 1, (uint8_t)ptr[0]);
+                return true;
+            case type_string16: {
+                uint16_t sz;
+                memcpy(&sz, ptr, sizeof(sz));
+                str = vstring(ptr + sizeof(sz), sz);
+                return true;
+            }
+            case type_string32: {
+                uint32_t sz;
+                memcpy(&sz, ptr, sizeof(sz));
+                str = vstring(ptr + sizeof(sz), sz);
+                return true;
+            }
+            case type_strindex:
+                str = m_shares[(uint8_t)ptr[0]];
+                return true;
+            }
+            return false;
+        }
+
+        //压入标量，字符串之外的类型走decode_value
+        void push_scalar(lua_State* L, uint32_t off) {
+            vstring str;
+            if (string_at(off, str)) {
+                lua_pushlstring(L, str.data(), str.size());
+                return;
+            }
+            slice mslice((uint8_t*)m_data + off + 1, m_len - off - 1);
+            decode_value(L, &mslice, m_data[off]);
+        }
+
+        bool is_nil(uint32_t off) {
+            return m_data[off] == type_nil;
+        }
+
+        //按lua键查找，返回项序号或lazy_none
+        uint32_t find(lua_State* L, uint32_t id, int key) {
+            lazy_node& n = m_nodes[id];
+            key = lua_absindex(L, key);
+            int ktype = lua_type(L, key);
+            lua_Integer ikey = 0;
+            bool integral = ktype == LUA_TNUMBER && _key_integer(L, key, ikey);
+            if (n.type == ext_array) {
+                if (!integral) return lazy_none;
+                return (ikey >= 1 && (lua_Unsigned)ikey <= n.count) ? (uint32_t)(ikey - 1) : lazy_none;
+            }
+            if (n.type == ext_record) {
+                if (ktype != LUA_TSTRING) return lazy_none;
+                uint32_t pos = lazy_none;
+                push_schema_info(L, n.schema);
+                for (uint32_t i = 0; i < n.count; ++i) {
+                    lua_rawgeti(L, -1, i + 1);
+                    bool found = lua_rawequal(L, -1, key);
+                    lua_pop(L, 1);
+                    if (found) {
+                        pos = i;
+                        break;
+                    }
+                }
+                lua_pop(L, 1);
+                return pos;
+            }
+            if (ktype == LUA_TSTRING) {
+                size_t sz;
+                cpchar ptr = lua_tolstring(L, key, &sz);
+                return _find_string(id, vstring(ptr, sz));
+            }
+            if (integral) return _find_integer(id, ikey);
+            if (ktype != LUA_TNUMBER && ktype != LUA_TBOOLEAN) return lazy_none;
+            for (uint32_t i = 0; i < n.count; ++i) {
+                lazy_entry& e = m_entries[n.first + i];
+                if (e.key_node != lazy_none) continue;
+                if (_key_equal(L, e.key, key)) return i;
+            }
+            return lazy_none;
+        }
+
+        //map从1开始连续的整数键个数，使用整数键索引
+        lua_Integer border(uint32_t id) {
+            auto& index = _integer_index(id);
+            lua_Integer len = 0;
+            while (index.find(len + 1) != index.end()) len++;
+            return len;
+        }
+
+        //压入结构的字段信息表
+        void push_schema_info(lua_State* L, uint32_t schema) {
+            push_schema_registry(L);
+            lua_rawgeti(L, -1, schema);
+            lua_rawgetp(L, -1, &schema_registry);
+            lua_replace(L, -3);
+            lua_pop(L, 1);
+        }
+
+    protected:
+        template <typename T>
+        T _read() {
+            if (m_len - m_pos < sizeof(T)) {
+                throw lua_exception("lazy decode data is out of range");
+            }
+            T val;
+            memcpy(&val, m_data + m_pos, sizeof(T));
+            m_pos += sizeof(T);
+            return val;
+        }
+
+        void _skip(size_t len) {
+            if (m_len - m_pos < len) {
+                throw lua_exception("lazy decode data is out of range");
+            }
+            m_pos += len;
+        }
+
+        uint64_t _varint() {
+            uint64_t val = 0;
+            size_t n = varint_decode(m_data + m_pos, m_len - m_pos, &val);
+            if (n == 0) {
+                throw lua_exception("lazy decode varint is invalid");
+            }
+            m_pos += n;
+            return val;
+        }
+
+        //跳过一个值，值为表时返回节点序号
+        uint32_t _value(lua_State* L, size_t depth) {
+            uint8_t type = _read<uint8_t>();
+            if (m_tabdef && type != type_tab_head && !(type == type_ext && m_pos < m_len && ext_table(m_data[m_pos]))) {
+                throw lua_exception("lazy decode table define has type {}", type);
+            }
+            switch (type) {
+            case type_number:
+            case type_int64:
+                _skip(8);
+                break;
+            case type_int16:
+                _skip(2);
+                break;
+            case type_int32:
+                _skip(4);
+                break;
+            case type_string8:
+                _skip(_read<uint8_t>());
+                break;
+            case type_string16:
+                _skip(_read<uint16_t>());
+                break;
+            case type_string32: {
+                uint32_t sz = _read<uint32_t>();
+                if (sz > max_string_size) {
+                    throw lua_exception("lazy decode string is out of range");
+                }
+                _skip(sz);
+                break;
+            }
+            case type_istring: {
+                uint8_t sz = _read<uint8_t>();
+                size_t pos = m_pos;
+                _skip(sz);
+                m_shares.emplace_back((cpchar)m_data + pos, sz);
+                break;
+            }
+            case type_strindex:
+                if (_read<uint8_t>() >= m_shares.size()) {
+                    throw lua_exception("lazy decode string index is out of range");
+                }
+                break;
+            case type_tab_head:
+                return _map(L, depth);
+            case type_ext:
+                switch (uint8_t ext = _read<uint8_t>()) {
+                case ext_map:
+                    _read<uint8_t>();
+                    return _map(L, depth);
+                case ext_array:
+                    return _array(L, depth);
+                case ext_record:
+                    return _record(L, depth);
+                case ext_tabdef:
+                    m_tabdef = true;
+                    return _value(L, depth);
+                case ext_tabref: {
+                    uint64_t index = _varint();
+                    if (index >= m_refs.size()) {
+                        throw lua_exception("lazy decode table reference is out of range");
+                    }
+                    return m_refs[index];
+                }
+                default:
+                    throw lua_exception("lazy decode extend type {} is invalid", ext);
+                }
+            }
+            return lazy_none;
+        }
+
+        uint32_t _open(uint8_t type, size_t depth) {
+            if (depth >= max_lazy_depth) {
+                throw lua_exception("lazy decode table is too depth");
+            }
+            uint32_t id = (uint32_t)m_nodes.size();
+            m_nodes.push_back({ type });
+            if (m_tabdef) {
+                m_refs.push_back(id);
+                m_tabdef = false;
+            }
+            return id;
+        }
+
+        //子表的项先出栈，每个表的项在entries中连续存放
+        uint32_t _close(uint32_t id, size_t base) {
+            lazy_node& n = m_nodes[id];
+            n.first = (uint32_t)m_entries.size();
+            n.count = (uint32_t)(m_stack.size() - base);
+            m_entries.insert(m_entries.end(), m_stack.begin() + base, m_stack.end());
+            m_stack.resize(base);
+            return id;
+        }
+
+        uint32_t _map(lua_State* L, size_t depth) {
+            uint32_t id = _open(ext_map, depth);
+            size_t base = m_stack.size();
+            while (true) {
+                if (m_pos >= m_len) {
+                    throw lua_exception("lazy decode data is out of range");
+                }
+                if (m_data[m_pos] == type_tab_tail) {
+                    m_pos++;
+                    break;
+                }
+                lazy_entry e;
+                e.key = (uint32_t)m_pos;
+                if (m_data[m_pos] == type_nil) {
+                    throw lua_exception("lazy decode table key is nil");
+                }
+                e.key_node = _value(L, depth + 1);
+                e.value = (uint32_t)m_pos;
+                e.node = _value(L, depth + 1);
+                m_stack.push_back(e);
+            }
+            return _close(id, base);
+        }
+
+        uint32_t _array(lua_State* L, size_t depth) {
+            uint32_t id = _open(ext_array, depth);
+            uint64_t count = _varint();
+            if (count > m_len - m_pos) {
+                throw lua_exception("lazy decode array count {} is out of range", count);
+            }
+            size_t base = m_stack.size();
+            for (uint64_t i = 0; i < count; ++i) {
+                uint32_t value = (uint32_t)m_pos;
+                uint32_t node = _value(L, depth + 1);
+                m_stack.push_back({ lazy_none, value, lazy_none, node });
+            }
+            return _close(id, base);
+        }
+
+        uint32_t _record(lua_State* L, size_t depth) {
+            uint32_t id = _open(ext_record, depth);
+            uint64_t schema = _varint();
+            push_schema_registry(L);
+            if (schema > UINT32_MAX || lua_rawgeti(L, -1, (lua_Integer)schema) != LUA_TTABLE) {
+                lua_pop(L, 2);
+                throw lua_exception("lazy decode schema {} is not registered", schema);
+            }
+            lua_rawgetp(L, -1, &schema_registry);
+            size_t count = lua_rawlen(L, -1);
+            lua_pop(L, 3);
+            m_nodes[id].schema = (uint32_t)schema;
+            size_t base = m_stack.size();
+            for (size_t i = 0; i < count; ++i) {
+                uint32_t value = (uint32_t)m_pos;
+                uint32_t node = _value(L, depth + 1);
+                m_stack.push_back({ lazy_none, value, lazy_none, node });
+            }
+            return _close(id, base);
+        }
+
+        uint32_t _find_string(uint32_t id, vstring key) {
+            lazy_node& n = m_nodes[id];
+            if (n.count > lazy_hash_min) {
+                auto& index = m_index[id];
+                if (index.empty()) {
+                    for (uint32_t i = 0; i < n.count; ++i) {
+                        vstring str;
+                        lazy_entry& e = m_entries[n.first + i];
+                        if (e.key_node == lazy_none && string_at(e.key, str)) index[str] = i;
+                    }
+                }
+                auto it = index.find(key);
+                return it == index.end() ? lazy_none : it->second;
+            }
+            for (uint32_t i = 0; i < n.count; ++i) {
+                vstring str;
+                lazy_entry& e = m_entries[n.first + i];
+                if (e.key_node == lazy_none && string_at(e.key, str) && str == key) return i;
+            }
+            return lazy_none;
+        }
+
+        //整数以及整数值的浮点数键按整数查找，与lua表的键规则一致
+        static bool _key_integer(lua_State* L, int key, lua_Integer& val) {
+            if (lua_isinteger(L, key)) {
+                val = lua_tointeger(L, key);
+                return true;
+            }
+            lua_Number num = lua_tonumber(L, key);
+            return num == std::floor(num) && lua_numbertointeger(num, &val);
+        }
+
+        //整数键索引，按整数首次查找大表或求长度时建立
+        std::unordered_map<lua_Integer, uint32_t>& _integer_index(uint32_t id) {
+            auto [it, inserted] = m_iindex.try_emplace(id);
+            if (inserted) {
+                lazy_node& n = m_nodes[id];
+                for (uint32_t i = 0; i < n.count; ++i) {
+                    int64_t val;
+                    if (_entry_integer(m_entries[n.first + i], val)) it->second.emplace(val, i);
+                }
+            }
+            return it->second;
+        }
+
+        //原生数据的浮点数键可能为整数值，lua解码后同样是整数键
+        bool _entry_integer(const lazy_entry& e, int64_t& val) {
+            if (e.key_node != lazy_none) return false;
+            if (m_data[e.key] == type_number) {
+                double num;
+                memcpy(&num, m_data + e.key + 1, sizeof(num));
+                return num == std::floor(num) && lua_numbertointeger(num, &val);
+            }
+            slice mslice((uint8_t*)m_data + e.key + 1, m_len - e.key - 1);
+            return typeint_decode(&mslice, m_data[e.key], val);
+        }
+
+        uint32_t _find_integer(uint32_t id, lua_Integer key) {
+            lazy_node& n = m_nodes[id];
+            if (n.count > lazy_hash_min || m_iindex.contains(id)) {
+                auto& index = _integer_index(id);
+                auto it = index.find(key);
+                return it == index.end() ? lazy_none : it->second;
+            }
+            for (uint32_t i = 0; i < n.count; ++i) {
+                int64_t val;
+                if (_entry_integer(m_entries[n.first + i], val) && val == key) return i;
+            }
+            return lazy_none;
+        }
+
+        //布尔和非整数值的浮点数键
+        bool _key_equal(lua_State* L, uint32_t off, int key) {
+            uint8_t type = m_data[off];
+            if (type == type_true || type == type_false) {
+                return lua_type(L, key) == LUA_TBOOLEAN && lua_toboolean(L, key) == (type == type_true);
+            }
+            if (lua_type(L, key) != LUA_TNUMBER) return false;
+            if (type != type_number) return false;
+            double val;
+            memcpy(&val, m_data + off + 1, sizeof(val));
+            return !lua_isinteger(L, key) && lua_tonumber(L, key) == val;
+        }
+
+    private:
+        size_t m_len = 0;
+        size_t m_pos = 0;
+        bool m_tabdef = false;
+        const uint8_t* m_data = nullptr;
+        std::vector<vstring> m_shares;
+        std::vector<uint32_t> m_refs;
+        std::vector<lazy_node> m_nodes;
+        std::vector<lazy_entry> m_args;
+        std::vector<lazy_entry> m_stack;
+        std::vector<lazy_entry> m_entries;
+        std::unordered_map<uint32_t, std::unordered_map<vstring, uint32_t>> m_index;
+        std::unordered_map<uint32_t, std::unordered_map<lua_Integer, uint32_t>> m_iindex;
+    };
+
+    //代理对象，uservalue为所属文档
+    struct lazy_table {
+        lazy_doc* doc;
+        uint32_t node;
+    };
+
+    inline lazy_table* lua_check_lazy(lua_State* L, int idx) {
+        return (lazy_table*)luaL_checkudata(L, idx, LAZY_META);
+    }
+
+    int lua_lazy_index(lua_State* L);
+    int lua_lazy_len(lua_State* L);
+    int lua_lazy_pairs(lua_State* L);
+
+    inline int lua_lazy_newindex(lua_State* L) {
+        return luaL_error(L, "lazy table is readonly");
+    }
+
+    inline int lua_lazy_tostring(lua_State* L) {
+        lua_pushfstring(L, "lazy table: %p", lua_touserdata(L, 1));
+        return 1;
+    }
+
+    //同一节点只生成一个代理，缓存在文档的第2个uservalue中
+    inline void lua_push_lazy_node(lua_State* L, int doc, uint32_t node) {
+        doc = lua_absindex(L, doc);
+        lua_getiuservalue(L, doc, 2);
+        if (lua_rawgeti(L, -1, node) != LUA_TNIL) {
+            lua_remove(L, -2);
+            return;
+        }
+        lua_pop(L, 1);
+        lazy_table* proxy = (lazy_table*)lua_newuserdatauv(L, sizeof(lazy_table), 1);
+        proxy->doc = (lazy_doc*)lua_touserdata(L, doc);
+        proxy->node = node;
+        lua_pushvalue(L, doc);
+        lua_setiuservalue(L, -2, 1);
+        if (luaL_newmetatable(L, LAZY_META)) {
+            luaL_Reg meta[] = {
+                { "__len", lua_lazy_len },
+                { "__index", lua_lazy_index },
+                { "__pairs", lua_lazy_pairs },
+                { "__newindex", lua_lazy_newindex },
+                { "__tostring", lua_lazy_tostring },
+                { NULL, NULL }
+            };
+            luaL_setfuncs(L, meta, 0);
+        }
+        lua_setmetatable(L, -2);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, -3, node);
+        lua_remove(L, -2);
+    }
+
+    inline void lua_push_lazy_value(lua_State* L, int doc, uint32_t off, uint32_t node) {
+        if (node != lazy_none) {
+            lua_push_lazy_node(L, doc, node);
+            return;
+        }
+        ((lazy_doc*)lua_touserdata(L, doc))->push_scalar(L, off);
+    }
+
+    inline int lua_lazy_index(lua_State* L) {
+        lazy_table* proxy = lua_check_lazy(L, 1);
+        lua_getiuservalue(L, 1, 1);
+        uint32_t i = proxy->doc->find(L, proxy->node, 2);
+        if (i == lazy_none) {
+            lua_pushnil(L);
+            return 1;
+        }
+        lazy_entry& e = proxy->doc->entry(proxy->doc->node(proxy->node), i);
+        lua_push_lazy_value(L, 3, e.value, e.node);
+        return 1;
+    }
+
+    //数组为元素个数，map为从1开始连续的整数键个数
+    inline int lua_lazy_len(lua_State* L) {
+        lazy_table* proxy = lua_check_lazy(L, 1);
+        lazy_node& n = proxy->doc->node(proxy->node);
+        lua_Integer len = 0;
+        if (n.type == ext_array) {
+            len = n.count;
+        } else if (n.type == ext_map) {
+            len = proxy->doc->border(proxy->node);
+        }
+        lua_pushinteger(L, len);
+        return 1;
+    }
+
+    //迭代位置保存在upvalue中，结构的nil字段跳过
+    inline int lua_lazy_next(lua_State* L) {
+        lazy_table* proxy = lua_check_lazy(L, 1);
+        lazy_doc* doc = proxy->doc;
+        lazy_node& n = doc->node(proxy->node);
+        lua_Integer i = lua_tointeger(L, lua_upvalueindex(1));
+        lua_getiuservalue(L, 1, 1);
+        int idoc = lua_gettop(L);
+        for (; i < n.count; ++i) {
+            lazy_entry& e = doc->entry(n, i);
+            if (n.type == ext_array) {
+                lua_pushinteger(L, i + 1);
+            } else if (n.type == ext_record) {
+                if (doc->is_nil(e.value)) continue;
+                doc->push_schema_info(L, n.schema);
+                lua_rawgeti(L, -1, i + 1);
+                lua_remove(L, -2);
+            } else {
+                lua_push_lazy_value(L, idoc, e.key, e.key_node);
+            }
+            lua_push_lazy_value(L, idoc, e.value, e.node);
+            lua_pushinteger(L, i + 1);
+            lua_replace(L, lua_upvalueindex(1));
+            return 2;
+        }
+        return 0;
+    }
+
+    inline int lua_lazy_pairs(lua_State* L) {
+        lua_check_lazy(L, 1);
+        lua_pushinteger(L, 0);
+        lua_pushcclosure(L, lua_lazy_next, 1);
+        lua_pushvalue(L, 1);
+        lua_pushnil(L);
+        return 3;
+    }
+
+    //完整转换为lua表，refs记录已转换的节点，保持共享和环
+    inline void lazy_materialize(lua_State* L, int idoc, uint32_t id, int refs) {
+        if (lua_rawgeti(L, refs, id) != LUA_TNIL) return;
+        lua_pop(L, 1);
+        luaL_checkstack(L, 8, "lazy materialize too depth");
+        lazy_doc* doc = (lazy_doc*)lua_touserdata(L, idoc);
+        lazy_node& n = doc->node(id);
+        int info = 0;
+        if (n.type == ext_record) {
+            doc->push_schema_info(L, n.schema);
+            info = lua_gettop(L);
+        }
+        if (n.type == ext_array) {
+            lua_createtable(L, (int)n.count, 0);
+        } else {
+            lua_createtable(L, 0, (int)n.count);
+        }
+        int table = lua_gettop(L);
+        lua_pushvalue(L, table);
+        lua_rawseti(L, refs, id);
+        for (uint32_t i = 0; i < n.count; ++i) {
+            lazy_entry& e = doc->entry(n, i);
+            if (n.type == ext_array) {
+                lua_pushinteger(L, i + 1);
+            } else if (n.type == ext_record) {
+                if (doc->is_nil(e.value)) continue;
+                lua_rawgeti(L, info, i + 1);
+            } else if (e.key_node != lazy_none) {
+                lazy_materialize(L, idoc, e.key_node, refs);
+            } else {
+                doc->push_scalar(L, e.key);
+            }
+            if (e.node != lazy_none) {
+                lazy_materialize(L, idoc, e.node, refs);
+            } else {
+                doc->push_scalar(L, e.value);
+            }
+            lua_rawset(L, table);
+        }
+        if (info) {
+            push_schema_registry(L);
+            lua_rawgeti(L, -1, n.schema);
+            lua_setmetatable(L, table);
+            lua_pop(L, 1);
+            lua_remove(L, info);
+        }
+    }
+
+    //luakit.materialize(v)：代理转换为lua表，其他值原样返回
+    inline int lua_materialize(lua_State* L) {
+        lazy_table* proxy = (lazy_table*)luaL_testudata(L, 1, LAZY_META);
+        if (!proxy) {
+            lua_settop(L, 1);
+            return 1;
+        }
+        lua_getiuservalue(L, 1, 1);
+        lua_newtable(L);
+        lazy_materialize(L, 2, proxy->node, 3);
+        return 1;
+    }
+
+    inline int lua_lazy_doc_gc(lua_State* L) {
+        ((lazy_doc*)lua_touserdata(L, 1))->~lazy_doc();
+        return 0;
+    }
+
+    //luakit.decode_lazy(data)：表返回代理，只在访问时生成
+    inline int lua_decode_lazy(lua_State* L) {
+        size_t len = 0;
+        cpchar data = luaL_checklstring(L, 1, &len);
+        lazy_doc* doc = new (lua_newuserdatauv(L, sizeof(lazy_doc), 2)) lazy_doc();
+        if (luaL_newmetatable(L, LAZY_DOC_META)) {
+            lua_pushcfunction(L, lua_lazy_doc_gc);
+            lua_setfield(L, -2, "__gc");
+        }
+        lua_setmetatable(L, -2);
+        //持有源字符串，索引和代理直接指向其内存
+        lua_pushvalue(L, 1);
+        lua_setiuservalue(L, -2, 1);
+        lua_newtable(L);
+        lua_setiuservalue(L, -2, 2);
+        int idoc = lua_gettop(L);
+        try {
+            doc->build(L, data, len);
+        } catch (const std::exception& e) {
+            luaL_error(L, e.what());
+        }
+        int argnum = (int)doc->argnum();
+        luaL_checkstack(L, argnum, "lazy decode too many results");
+        for (int i = 0; i < argnum; ++i) {
+            lazy_entry& e = doc->arg(i);
+            lua_push_lazy_value(L, idoc, e.value, e.node);
+        }
+        return argnum;
+    }
+}
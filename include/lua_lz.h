@@ -0,0 +1,163 @@
+#pragma once
+
+#include "lua_base.h"
+
+namespace luakit {
+
+    //LZ77块压缩，序列格式与lz4 block一致：
+    //token(字面量长度:4 | 匹配长度-4:4) + [扩展长度] + 字面量 + 偏移(2字节小端) + [扩展长度]
+    //最后一个序列只有字面量
+    const size_t LZ_HASH_BITS   = 12;
+    const size_t LZ_MIN_MATCH   = 4;
+    const size_t LZ_MAX_OFFSET  = 65535;
+    const size_t LZ_LAST_LITERALS = 5;  //末尾至少保留的字面量
+    const size_t LZ_MFLIMIT     = 12;   //末尾这段内不再开始匹配
+    const size_t LZ_SKIP_TRIGGER = 6;   //连续未命中时加大步长
+
+    //压缩结果的最大长度
+    inline size_t lz_bound(size_t len) {
+        return len + len / 255 + 16;
+    }
+
+    inline uint32_t lz_read32(const uint8_t* p) {
+        uint32_t val;
+        memcpy(&val, p, sizeof(val));
+        return val;
+    }
+
+    inline uint64_t lz_read64(const uint8_t* p) {
+        uint64_t val;
+        memcpy(&val, p, sizeof(val));
+        return val;
+    }
+
+    inline uint32_t lz_hash(uint32_t seq) {
+        return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+    }
+
+    inline uint8_t* lz_write_length(uint8_t* op, size_t len) {
+        while (len >= 255) {
+            *op++ = 255;
+            len -= 255;
+        }
+        *op++ = (uint8_t)len;
+        return op;
+    }
+
+    inline bool lz_read_length(const uint8_t*& ip, const uint8_t* iend, size_t& len, size_t limit) {
+        uint8_t b;
+        do {
+            if (ip >= iend) return false;
+            b = *ip++;
+            len += b;
+            if (len > limit) return false;
+        } while (b == 255);
+        return true;
+    }
+
+    //按8字节比较求公共前缀长度(小端)
+    inline size_t lz_match_length(const uint8_t* ip, const uint8_t* ref, const uint8_t* limit) {
+        const uint8_t* start = ip;
+        while (ip + sizeof(uint64_t) <= limit) {
+            uint64_t diff = lz_read64(ip) ^ lz_read64(ref);
+            if (diff) return ip - start + (std::countr_zero(diff) >> 3);
+            ip += sizeof(uint64_t);
+            ref += sizeof(uint64_t);
+        }
+        while (ip < limit && *ip == *ref) {
+            ip++;
+            ref++;
+        }
+        return ip - start;
+    }
+
+    inline uint8_t* lz_write_sequence(uint8_t* op, const uint8_t* anchor, size_t lit, size_t offset, size_t mlen) {
+        uint8_t* token = op++;
+        *token = (uint8_t)(std::min<size_t>(lit, 15) << 4);
+        if (lit >= 15) op = lz_write_length(op, lit - 15);
+        memcpy(op, anchor, lit);
+        op += lit;
+        if (mlen == 0) return op;
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        mlen -= LZ_MIN_MATCH;
+        *token |= (uint8_t)std::min<size_t>(mlen, 15);
+        if (mlen >= 15) op = lz_write_length(op, mlen - 15);
+        return op;
+    }
+
+    //压缩到dest，dest空间需不小于lz_bound(len)，返回压缩后的长度
+    inline size_t lz_compress(const uint8_t* src, size_t len, uint8_t* dest) {
+        uint32_t table[1 << LZ_HASH_BITS] = {};
+        const uint8_t* ip = src;
+        const uint8_t* anchor = src;
+        const uint8_t* end = src + len;
+        uint8_t* op = dest;
+        if (len > LZ_MFLIMIT) {
+            const uint8_t* limit = end - LZ_MFLIMIT;
+            const uint8_t* mlimit = end - LZ_LAST_LITERALS;
+            size_t misses = 1 << LZ_SKIP_TRIGGER;
+            ip++;
+            while (ip < limit) {
+                uint32_t seq = lz_read32(ip);
+                uint32_t h = lz_hash(seq);
+                const uint8_t* ref = src + table[h];
+                table[h] = (uint32_t)(ip - src);
+                if (ref >= ip || (size_t)(ip - ref) > LZ_MAX_OFFSET || lz_read32(ref) != seq) {
+                    ip += misses++ >> LZ_SKIP_TRIGGER;
+                    continue;
+                }
+                misses = 1 << LZ_SKIP_TRIGGER;
+                while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                    ip--;
+                    ref--;
+                }
+                size_t mlen = LZ_MIN_MATCH + lz_match_length(ip + LZ_MIN_MATCH, ref + LZ_MIN_MATCH, mlimit);
+                op = lz_write_sequence(op, anchor, ip - anchor, ip - ref, mlen);
+                ip += mlen;
+                anchor = ip;
+                if (ip < limit) {
+                    table[lz_hash(lz_read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+                }
+            }
+        }
+        return lz_write_sequence(op, anchor, end - anchor, 0, 0) - dest;
+    }
+
+    //解压到dest，解压长度需与dest_len一致，数据错误返回false
+    inline bool lz_decompress(const uint8_t* src, size_t len, uint8_t* dest, size_t dest_len) {
+        const uint8_t* ip = src;
+        const uint8_t* iend = src + len;
+        uint8_t* op = dest;
+        uint8_t* oend = dest + dest_len;
+        while (ip < iend) {
+            uint8_t token = *ip++;
+            size_t lit = token >> 4;
+            if (lit == 15 && !lz_read_length(ip, iend, lit, dest_len)) return false;
+            if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit) return false;
+            memcpy(op, ip, lit);
+            op += lit;
+            ip += lit;
+            if (ip == iend) break;
+            if (iend - ip < 2) return false;
+            size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            if (offset == 0 || offset > (size_t)(op - dest)) return false;
+            size_t mlen = token & 15;
+            if (mlen == 15 && !lz_read_length(ip, iend, mlen, dest_len)) return false;
+            mlen += LZ_MIN_MATCH;
+            if ((size_t)(oend - op) < mlen) return false;
+            const uint8_t* ref = op - offset;
+            if (offset >= mlen) {
+                memcpy(op, ref, mlen);
+                op += mlen;
+            } else {
+                //重叠复制，逐字节展开重复内容
+                for (size_t i = 0; i < mlen; ++i) {
+                    *op++ = *ref++;
+                }
+            }
+        }
+        return op == oend;
+    }
+}
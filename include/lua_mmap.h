@@ -0,0 +1,126 @@
+#pragma once
+
+#ifdef WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "lua_slice.h"
+
+namespace luakit {
+
+    //只读映射文件的slice，析构时解除映射
+    class mapped_slice : public slice {
+    public:
+        mapped_slice() {}
+        ~mapped_slice() { close(); }
+        mapped_slice(const mapped_slice&) = delete;
+        mapped_slice& operator =(const mapped_slice&) = delete;
+
+        //由lua管理生命周期
+        void __gc() { delete this; }
+
+        bool open(cpchar path) {
+            close();
+#ifdef WIN32
+            m_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (m_file == INVALID_HANDLE_VALUE) return false;
+            LARGE_INTEGER fsize;
+            if (!GetFileSizeEx(m_file, &fsize)) {
+                close();
+                return false;
+            }
+            m_len = (size_t)fsize.QuadPart;
+            if (m_len > 0) {
+                m_map = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+                if (!m_map) {
+                    close();
+                    return false;
+                }
+                m_addr = (uint8_t*)MapViewOfFile(m_map, FILE_MAP_READ, 0, 0, 0);
+                if (!m_addr) {
+                    close();
+                    return false;
+                }
+            }
+#else
+            int fd = ::open(path, O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                ::close(fd);
+                return false;
+            }
+            m_len = (size_t)st.st_size;
+            if (m_len > 0) {
+                void* addr = mmap(nullptr, m_len, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (addr == MAP_FAILED) {
+                    ::close(fd);
+                    m_len = 0;
+                    return false;
+                }
+                madvise(addr, m_len, MADV_SEQUENTIAL);
+                m_addr = (uint8_t*)addr;
+            }
+            ::close(fd);
+#endif
+            m_opened = true;
+            rewind();
+            return true;
+        }
+
+        void close() {
+#ifdef WIN32
+            if (m_addr) UnmapViewOfFile(m_addr);
+            if (m_map) CloseHandle(m_map);
+            if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+            m_map = NULL;
+            m_file = INVALID_HANDLE_VALUE;
+#else
+            if (m_addr) munmap(m_addr, m_len);
+#endif
+            m_addr = nullptr;
+            m_opened = false;
+            m_len = 0;
+            attach(nullptr, 0);
+        }
+
+        //回到文件起始位置
+        void rewind() {
+            attach(m_addr, m_len);
+        }
+
+        bool is_open() {
+            return m_opened;
+        }
+
+        size_t file_size() {
+            return m_len;
+        }
+
+    private:
+        size_t m_len = 0;
+        bool m_opened = false;
+        uint8_t* m_addr = nullptr;
+#ifdef WIN32
+        HANDLE m_map = NULL;
+        HANDLE m_file = INVALID_HANDLE_VALUE;
+#endif
+    };
+
+    inline mapped_slice* mmap_file(cpchar path) {
+        mapped_slice* mslice = new mapped_slice();
+        if (!mslice->open(path)) {
+            delete mslice;
+            return nullptr;
+        }
+        return mslice;
+    }
+}
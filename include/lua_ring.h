@@ -0,0 +1,297 @@
+#pragma once
+
+#include "lua_buff.h"
+
+namespace luakit {
+
+    //环形缓冲区：读写都不移动数据，回绕处通过两段iovec或peek_copy访问
+    //容量始终是BUFFER_DEF的2次幂倍，只有扩容时才会整理数据
+    class ring_buf {
+    public:
+        ring_buf(buff_alloc* alloc = default_alloc()) : m_alloc(alloc) {
+            m_data = m_alloc->alloc(BUFFER_DEF);
+            m_size = BUFFER_DEF;
+            m_max = m_size * ALIGN_SIZE;
+        }
+        ~ring_buf() { m_alloc->release(m_data, m_size); }
+        ring_buf(const ring_buf&) = delete;
+        ring_buf& operator =(const ring_buf&) = delete;
+
+        inline void reset() {
+            if (m_size != BUFFER_DEF) {
+                m_alloc->release(m_data, m_size);
+                m_data = m_alloc->alloc(BUFFER_DEF);
+                m_size = BUFFER_DEF;
+            }
+            m_head = m_tail = 0;
+            m_slice.expire();
+        }
+
+        inline void clean() {
+            if (m_size > m_max) {
+                m_alloc->release(m_data, m_size);
+                m_size = m_size / 2;
+                m_data = m_alloc->alloc(m_size);
+            }
+            m_head = m_tail = 0;
+            m_slice.expire();
+        }
+
+        inline size_t size() {
+            return m_tail - m_head;
+        }
+
+        inline size_t capacity() {
+            return m_size;
+        }
+
+        inline size_t empty() {
+            return m_tail == m_head;
+        }
+
+        inline size_t space() {
+            return m_size - (m_tail - m_head);
+        }
+
+        //数据是否跨过回绕点
+        inline bool wrapped() {
+            return _offset(m_head) + size() > m_size;
+        }
+
+        inline size_t push_data(cpbyte src, size_t push_len) {
+            if (push_len == 0) return 0;
+            if (space() < push_len && !_grow(push_len)) {
+                return 0;
+            }
+            _expire_slice(m_tail + push_len);
+            _copy_in(m_tail, src, push_len);
+            m_tail += push_len;
+            return push_len;
+        }
+
+        inline size_t pop_data(uint8_t* dest, size_t pop_len) {
+            if (pop_len == 0 || size() < pop_len) return 0;
+            _copy_out(m_head, dest, pop_len);
+            pop_size(pop_len);
+            return pop_len;
+        }
+
+        inline size_t pop_size(size_t erase_len) {
+            if (size() < erase_len) return 0;
+            m_head += erase_len;
+            if (m_head == m_tail) {
+                m_head = m_tail = 0;
+                m_slice.expire();
+            }
+            return erase_len;
+        }
+
+        //拷贝出[offset, offset + len)，可以跨过回绕点，用于读取包头
+        inline size_t peek_copy(uint8_t* dest, size_t peek_len, size_t offset = 0) {
+            if (peek_len == 0 || offset > size() || size() - offset < peek_len) return 0;
+            _copy_out(m_head + offset, dest, peek_len);
+            return peek_len;
+        }
+
+        template <arithmetic T>
+        inline bool peek_value(T* val, size_t offset = 0) {
+            return peek_copy((uint8_t*)val, sizeof(T), offset) > 0;
+        }
+
+        //跨过回绕点时拷贝到线性缓存中
+        inline uint8_t* peek_data(size_t peek_len, size_t offset = 0) {
+            if (peek_len == 0 || offset > size() || size() - offset < peek_len) {
+                return nullptr;
+            }
+            size_t start = _offset(m_head + offset);
+            if (start + peek_len <= m_size) {
+                return m_data + start;
+            }
+            m_line.resize(peek_len);
+            m_slice.expire();
+            _copy_out(m_head + offset, m_line.data(), peek_len);
+            return m_line.data();
+        }
+
+        //尾部的连续空间，总空间不足时扩容
+        //总空间足够但跨过回绕点时返回nullptr，不移动数据，此时需使用space_iov
+        inline uint8_t* peek_space(size_t len) {
+            if (m_head == m_tail) {
+                m_head = m_tail = 0;
+            }
+            if (space() < len && !_grow(len)) {
+                return nullptr;
+            }
+            size_t start = _offset(m_tail);
+            if (m_size - start < len) {
+                return nullptr;
+            }
+            _expire_slice(m_tail + len);
+            return m_data + start;
+        }
+
+        inline size_t pop_space(size_t space_len) {
+            if (space() < space_len) return 0;
+            m_tail += space_len;
+            return space_len;
+        }
+
+        //导出可读区域，回绕时为两段
+        inline size_t peek_iov(iovec* iov, size_t count) {
+            return _segments(iov, count, m_head, size());
+        }
+
+        //导出至少len字节的可写区域，回绕时为两段，写入后调用pop_space提交
+        inline size_t space_iov(iovec* iov, size_t count, size_t len) {
+            if (space() < len && !_grow(len)) return 0;
+            if (m_head == m_tail) {
+                m_head = m_tail = 0;
+            }
+            _expire_slice(m_head + m_size);
+            return _segments(iov, count, m_tail, space());
+        }
+
+        inline slice* get_slice(size_t len = 0, uint32_t offset = 0) {
+            if (offset > size()) offset = (uint32_t)size();
+            if (len == 0) len = size() - offset;
+            uint8_t* data = peek_data(len, offset);
+            m_slice.attach(data, data ? len : 0);
+            //视图在环内时，写入位置超过其起点一圈后会覆盖它
+            m_slice_limit = (data && data != m_line.data()) ? m_head + offset + m_size : SIZE_MAX;
+            return &m_slice;
+        }
+
+        inline uint8_t* data(size_t* len) {
+            *len = size();
+            if (*len == 0) return m_data;
+            return peek_data(*len);
+        }
+
+        inline vstring string() {
+            size_t len = 0;
+            cpchar data = (cpchar)this->data(&len);
+            return vstring(data, len);
+        }
+
+        inline size_t write(cpchar src) {
+            return push_data((cpbyte)src, strlen(src));
+        }
+
+        inline size_t write(cstring& src) {
+            return push_data((cpbyte)src.c_str(), src.size());
+        }
+
+        inline size_t write(cvstring src) {
+            return push_data((cpbyte)src.data(), src.size());
+        }
+
+        template <arithmetic T, size_t N = sizeof(T)>
+        inline size_t write(T val) {
+            return push_data((cpbyte)&val, N);
+        }
+
+        template <arithmetic T = uint8_t, size_t N = sizeof(T)>
+        inline T read() {
+            T val;
+            if (pop_data((uint8_t*)&val, N) == 0) {
+                throw std::length_error("ring read not engugh!");
+            }
+            return val;
+        }
+
+        template <std::integral T, size_t N = sizeof(T)>
+        inline size_t swap_write(T val) {
+            static_assert(N <= sizeof(T) && N > 0, "invalid byte count N");
+            val = byteswap(val);
+            return push_data(reinterpret_cast<uint8_t*>(&val) + sizeof(T) - N, N);
+        }
+
+        template <std::integral T, size_t N = sizeof(T)>
+        inline T swap_read() {
+            static_assert(N <= sizeof(T) && N > 0, "invalid byte count N");
+            T val = 0;
+            if (pop_data(reinterpret_cast<uint8_t*>(&val) + sizeof(T) - N, N) == 0) {
+                throw std::length_error("ring read not engugh!");
+            }
+            return byteswap(val);
+        }
+
+    protected:
+        inline size_t _offset(size_t pos) {
+            return pos & (m_size - 1);
+        }
+
+        size_t _segments(iovec* iov, size_t count, size_t pos, size_t len) {
+            if (count == 0 || len == 0) return 0;
+            size_t start = _offset(pos);
+            size_t first = std::min(len, m_size - start);
+            iov[0].iov_base = m_data + start;
+            iov[0].iov_len = first;
+            if (first == len || count < 2) return 1;
+            iov[1].iov_base = m_data;
+            iov[1].iov_len = len - first;
+            return 2;
+        }
+
+        void _copy_in(size_t pos, cpbyte src, size_t len) {
+            size_t start = _offset(pos);
+            size_t first = std::min(len, m_size - start);
+            memcpy(m_data + start, src, first);
+            if (first < len) {
+                memcpy(m_data, src + first, len - first);
+            }
+        }
+
+        void _copy_out(size_t pos, uint8_t* dest, size_t len) {
+            size_t start = _offset(pos);
+            size_t first = std::min(len, m_size - start);
+            memcpy(dest, m_data + start, first);
+            if (first < len) {
+                memcpy(dest + first, m_data, len - first);
+            }
+        }
+
+        //写入[m_tail, end)会覆盖get_slice视图(数据已被读走)时，使视图失效
+        void _expire_slice(size_t end) {
+            if (end > m_slice_limit) {
+                m_slice.expire();
+                m_slice_limit = SIZE_MAX;
+            }
+        }
+
+        //扩容，同时把数据整理到起始位置
+        bool _grow(size_t len) {
+            size_t data_len = size();
+            size_t nsize = m_size * 2;
+            while (nsize - data_len < len) {
+                nsize *= 2;
+            }
+            if (nsize > BUFFER_MAX) {
+                return false;
+            }
+            uint8_t* data = m_alloc->alloc(nsize);
+            if (!data) return false;
+            if (data_len > 0) {
+                _copy_out(m_head, data, data_len);
+            }
+            m_alloc->release(m_data, m_size);
+            m_data = data;
+            m_size = nsize;
+            m_head = 0;
+            m_tail = data_len;
+            m_slice.expire();
+            return true;
+        }
+
+    private:
+        size_t m_max;
+        size_t m_size;
+        size_t m_head = 0;
+        size_t m_tail = 0;
+        uint8_t* m_data;
+        buff_alloc* m_alloc;
+        std::vector<uint8_t> m_line;
+        slice m_slice;
+        size_t m_slice_limit = SIZE_MAX;
+    };
+}
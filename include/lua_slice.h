@@ -1,18 +1,99 @@
 #pragma once
 
-#include "lua_base.h"
+#include "lua_view.h"
 
 namespace luakit {
 
     template<typename T>
     concept arithmetic = std::is_arithmetic_v<T>;
 
+    const size_t ARRAY_BATCH = 256;     //批量转换时每批的元素个数
+
+    //按string.pack的格式字符分发数组元素类型
+    template <typename F>
+    bool array_dispatch(char fmt, F&& fn) {
+        switch (fmt) {
+        case 'b': fn(int8_t()); return true;
+        case 'B': fn(uint8_t()); return true;
+        case 'h': fn(int16_t()); return true;
+        case 'H': fn(uint16_t()); return true;
+        case 'i': fn(int32_t()); return true;
+        case 'I': fn(uint32_t()); return true;
+        case 'l': fn(int64_t()); return true;
+        case 'f': fn(float()); return true;
+        case 'd': fn(double()); return true;
+        }
+        return false;
+    }
+
+    const size_t VARINT_MAX = 10;       //64位varint最大字节数
+
+    inline uint64_t zigzag_encode(int64_t val) {
+        return ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+    }
+
+    inline int64_t zigzag_decode(uint64_t val) {
+        return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+    }
+
+    //LEB128编码，dest至少VARINT_MAX字节，返回编码长度
+    inline size_t varint_encode(uint8_t* dest, uint64_t val) {
+        size_t len = 0;
+        while (val >= 0x80) {
+            dest[len++] = (uint8_t)val | 0x80;
+            val >>= 7;
+        }
+        dest[len++] = (uint8_t)val;
+        return len;
+    }
+
+    //LEB128解码，数据不完整或超长时返回0
+    inline size_t varint_decode(const uint8_t* data, size_t data_len, uint64_t* val) {
+        if (data_len > 0 && data[0] < 0x80) {
+            *val = data[0];
+            return 1;
+        }
+        uint64_t res = 0;
+        if (data_len >= VARINT_MAX) {
+            //数据足够时省去边界检查，循环次数固定便于展开
+            for (size_t i = 0; i < VARINT_MAX; ++i) {
+                uint64_t byte = data[i];
+                res |= (byte & 0x7f) << (7 * i);
+                if (byte < 0x80) {
+                    *val = res;
+                    return i + 1;
+                }
+            }
+            return 0;
+        }
+        for (size_t i = 0; i < data_len; ++i) {
+            uint64_t byte = data[i];
+            res |= (byte & 0x7f) << (7 * i);
+            if (byte < 0x80) {
+                *val = res;
+                return i + 1;
+            }
+        }
+        return 0;
+    }
+
     class slice {
     public:
         slice() {}
         slice(uint8_t* data, size_t size) {
             attach(data, size);
         }
+        //拷贝只复制数据区间，视图守卫不共享
+        slice(const slice& other) {
+            attach(other.m_head, other.m_tail - other.m_head);
+        }
+        slice& operator =(const slice& other) {
+            attach(other.m_head, other.m_tail - other.m_head);
+            return *this;
+        }
+        ~slice() {
+            if (m_guard) m_guard->gen = nullptr;
+        }
 
         void __gc() {}
 
@@ -31,6 +112,12 @@ namespace luakit {
         inline void attach(uint8_t* data, size_t size) {
             m_head = data;
             m_tail = data + size;
+            m_gen++;
+        }
+
+        //所指内存被移动或复用，使已导出的视图失效
+        inline void expire() {
+            m_gen++;
         }
 
         inline uint8_t* peek(size_t peek_len, size_t offset = 0) {
@@ -84,6 +171,52 @@ namespace luakit {
             throw std::length_error("slice read not engugh!");
         }
 
+        //批量读取count个元素，swap为true时翻转字节序
+        template <arithmetic T>
+        inline size_t read_array(T* dest, size_t count, bool swap = false) {
+            size_t len = count * sizeof(T);
+            if (count == 0 || (size_t)(m_tail - m_head) < len) return 0;
+            if (swap) {
+                byteswap_array(dest, (const T*)m_head, count);
+            } else {
+                memcpy(dest, m_head, len);
+            }
+            m_head += len;
+            return count;
+        }
+
+        inline uint64_t read_varint() {
+            uint64_t val;
+            size_t len = varint_decode(m_head, m_tail - m_head, &val);
+            if (len == 0) {
+                throw std::length_error("slice read varint failed!");
+            }
+            m_head += len;
+            return val;
+        }
+
+        inline int64_t read_zigzag() {
+            return zigzag_decode(read_varint());
+        }
+
+        //批量读取varint，返回成功读取的个数
+        inline size_t read_varints(uint64_t* dest, size_t count) {
+            for (size_t i = 0; i < count; ++i) {
+                size_t len = varint_decode(m_head, m_tail - m_head, &dest[i]);
+                if (len == 0) return i;
+                m_head += len;
+            }
+            return count;
+        }
+
+        inline size_t read_zigzags(int64_t* dest, size_t count) {
+            size_t n = read_varints((uint64_t*)dest, count);
+            for (size_t i = 0; i < n; ++i) {
+                dest[i] = zigzag_decode((uint64_t)dest[i]);
+            }
+            return n;
+        }
+
         inline uint8_t* data(size_t* len) {
             *len = (size_t)(m_tail - m_head);
             return m_head;
@@ -93,6 +226,14 @@ namespace luakit {
             return m_head;
         }
 
+        //导出可读区域，用于writev
+        inline size_t peek_iov(iovec* iov, size_t count) {
+            if (count == 0 || m_tail == m_head) return 0;
+            iov[0].iov_base = m_head;
+            iov[0].iov_len = m_tail - m_head;
+            return 1;
+        }
+
         inline vstring contents() {
             size_t len = (size_t)(m_tail - m_head);
             return vstring((cpchar)m_head, len);
@@ -131,8 +272,138 @@ namespace luakit {
             lua_pushlstring(L, (cpchar)m_head, len);
             return 1;
         }
-        
+
+        //lua: read_array(fmt, count, swap, tab)，读取数组到tab中
+        inline int unpack_array(lua_State* L) {
+            cpchar fmt = luaL_checkstring(L, 1);
+            lua_Integer icount = luaL_checkinteger(L, 2);
+            if (icount < 0) {
+                luaL_error(L, "read array count must be non-negative");
+            }
+            size_t count = (size_t)icount;
+            bool swap = lua_toboolean(L, 3);
+            size_t data_len = m_tail - m_head;
+            bool enough = true;
+            bool valid = array_dispatch(fmt[0], [&](auto tag) {
+                using T = decltype(tag);
+                if (data_len / sizeof(T) < count) {
+                    enough = false;
+                    return;
+                }
+                if (lua_istable(L, 4)) {
+                    lua_settop(L, 4);
+                } else {
+                    lua_createtable(L, (int)count, 0);
+                }
+                T vals[ARRAY_BATCH];
+                for (size_t i = 0; i < count; i += ARRAY_BATCH) {
+                    size_t n = read_array(vals, std::min(ARRAY_BATCH, count - i), swap);
+                    for (size_t j = 0; j < n; ++j) {
+                        if constexpr (std::is_floating_point_v<T>) {
+                            lua_pushnumber(L, vals[j]);
+                        } else {
+                            lua_pushinteger(L, (lua_Integer)vals[j]);
+                        }
+                        lua_rawseti(L, -2, i + j + 1);
+                    }
+                }
+            });
+            if (!valid) {
+                luaL_error(L, "invalid array format: %s", fmt);
+            }
+            return enough ? 1 : 0;
+        }
+
+        //lua: varint()/zigzag()，数据不完整时返回nil且不消费
+        inline int varint(lua_State* L) {
+            uint64_t val;
+            size_t len = varint_decode(m_head, m_tail - m_head, &val);
+            if (len == 0) return 0;
+            m_head += len;
+            lua_pushinteger(L, (lua_Integer)val);
+            return 1;
+        }
+
+        inline int zigzag(lua_State* L) {
+            uint64_t val;
+            size_t len = varint_decode(m_head, m_tail - m_head, &val);
+            if (len == 0) return 0;
+            m_head += len;
+            lua_pushinteger(L, zigzag_decode(val));
+            return 1;
+        }
+
+        //lua: varints(count, zigzag, tab)，数据不完整时返回nil且不消费
+        inline int varints(lua_State* L) {
+            lua_Integer icount = luaL_checkinteger(L, 1);
+            if (icount < 0) {
+                luaL_error(L, "read varints count must be non-negative");
+            }
+            //每个varint至少1字节，数据不足时不必建表
+            size_t count = (size_t)icount;
+            if (count > (size_t)(m_tail - m_head)) return 0;
+            bool zigzag = lua_toboolean(L, 2);
+            if (lua_istable(L, 3)) {
+                lua_settop(L, 3);
+            } else {
+                lua_createtable(L, (int)count, 0);
+            }
+            uint8_t* head = m_head;
+            uint64_t vals[ARRAY_BATCH];
+            for (size_t i = 0; i < count; i += ARRAY_BATCH) {
+                size_t n = std::min(ARRAY_BATCH, count - i);
+                if (read_varints(vals, n) != n) {
+                    m_head = head;
+                    return 0;
+                }
+                for (size_t j = 0; j < n; ++j) {
+                    lua_pushinteger(L, zigzag ? zigzag_decode(vals[j]) : (lua_Integer)vals[j]);
+                    lua_rawseti(L, -2, i + j + 1);
+                }
+            }
+            return 1;
+        }
+
+        //以下接口返回视图，不拷贝数据
+        inline int peek_view(lua_State* L) {
+            size_t peek_len = lua_tointeger(L, 1);
+            size_t data_len = m_tail - m_head;
+            if (peek_len > 0 && data_len >= peek_len) {
+                push_view(L, m_head, peek_len);
+                return 1;
+            }
+            return 0;
+        }
+
+        inline int recv_view(lua_State* L) {
+            size_t data_len = m_tail - m_head;
+            size_t read_len = lua_tointeger(L, 1);
+            if (read_len > 0 && data_len >= read_len) {
+                push_view(L, m_head, read_len);
+                m_head += read_len;
+                return 1;
+            }
+            return 0;
+        }
+
+        inline int view(lua_State* L) {
+            push_view(L, m_head, m_tail - m_head);
+            return 1;
+        }
+
+    protected:
+        void push_view(lua_State* L, uint8_t* data, size_t len) {
+            if (!m_guard) {
+                m_guard = std::make_shared<view_guard>(view_guard{ &m_gen });
+            }
+            lua_push_object(L, this);
+            lua_push_view(L, -1, m_guard, (cpchar)data, len);
+            lua_remove(L, -2);
+        }
+
     protected:
+        uint32_t m_gen = 0;
+        view_guard_ptr m_guard = nullptr;
         uint8_t* m_head = nullptr;
         uint8_t* m_tail = nullptr;
     };
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <filesystem>
+
 #include "lua_base.h"
 
 namespace luakit {
@@ -0,0 +1,428 @@
+#pragma once
+
+#include "lua_codec.h"
+
+namespace luakit {
+
+    //流式解码状态
+    const int stream_more   = 0;    //需要更多数据
+    const int stream_done   = 1;    //一条消息解码完成
+    const int stream_error  = -1;   //数据错误，见err()
+
+    const size_t max_stream_depth   = 64;       //嵌套层数上限
+    const size_t max_stream_presize = 1 << 16;  //按头部预分配的上限，数据未到齐无法校验
+
+    //增量解码器：数据可以分多次送入，从中断处继续，不抛出异常
+    //以完整的token(类型+长度+内容)为单位推进，未完成的表保存在独立的lua线程栈上
+    //不支持会话字典模式，支持引用模式
+    //会话字典模式的连接需以session构造，遇到共享字符串时返回stream_error，避免按普通格式误解析
+    class stream_decoder {
+    public:
+        stream_decoder(lua_State* L, bool session = false) : m_session(session) {
+            m_co = lua_newthread(L);
+            m_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        }
+        ~stream_decoder() {
+            lua_pushnil(m_co);
+            lua_rawsetp(m_co, LUA_REGISTRYINDEX, this);
+            luaL_unref(m_co, LUA_REGISTRYINDEX, m_ref);
+        }
+        stream_decoder(const stream_decoder&) = delete;
+        stream_decoder& operator =(const stream_decoder&) = delete;
+
+        //由lua管理生命周期
+        void __gc() { delete this; }
+
+        //丢弃未完成的消息和缓存数据
+        void reset() {
+            m_buf.clean();
+            m_err.clear();
+            _restart();
+        }
+
+        //送入数据并继续解码
+        int feed(cpbyte data, size_t len) {
+            if (m_state == stream_error) return m_state;
+            if (len > 0 && m_buf.push_data(data, len) == 0) {
+                return _fail("stream decode buffer is full");
+            }
+            return step();
+        }
+
+        //解码已缓存的数据
+        int step() {
+            while (m_state == stream_more) {
+                size_t len = 0;
+                const uint8_t* data = m_buf.data(&len);
+                size_t used = m_argnum < 0 ? _header(data, len) : _token(data, len);
+                if (used == 0) break;
+                m_buf.pop_size(used);
+            }
+            return m_state;
+        }
+
+        //取出解码结果，之后可以继续解码下一条消息
+        int results(lua_State* L) {
+            if (m_state != stream_done) return 0;
+            int count = m_argnum;
+            lua_xmove(m_co, L, count);
+            _restart();
+            return count;
+        }
+
+        size_t pending() {
+            return m_buf.size();
+        }
+
+        cpchar err() {
+            return m_err.c_str();
+        }
+
+        //lua: feed(data)，返回状态
+        int lua_feed(lua_State* L) {
+            size_t len = 0;
+            cpchar data = luaL_optlstring(L, 1, "", &len);
+            lua_pushinteger(L, feed((cpbyte)data, len));
+            return 1;
+        }
+
+        //lua: results()，返回解码出的参数
+        int lua_results(lua_State* L) {
+            luaL_checkstack(L, m_argnum > 0 ? m_argnum : 1, "stream decode too many results");
+            return results(L);
+        }
+
+    protected:
+        enum class frame_type { map, array, record };
+
+        struct frame {
+            frame_type type;
+            int table;              //表在线程栈上的位置
+            size_t count = 0;       //数组/结构的元素个数
+            size_t index = 0;       //已填充的元素个数
+            bool value = false;     //map正在等待值
+        };
+
+        void _restart() {
+            lua_settop(m_co, 0);
+            m_frames.clear();
+            m_shares.clear();
+            m_argnum = -1;
+            m_values = 0;
+            m_state = stream_more;
+            m_tabdef = false;
+            if (m_tabdefs > 0) {
+                m_tabdefs = 0;
+                lua_pushnil(m_co);
+                lua_rawsetp(m_co, LUA_REGISTRYINDEX, this);
+            }
+        }
+
+        int _fail(cpchar err) {
+            m_err = err;
+            m_state = stream_error;
+            return m_state;
+        }
+
+        size_t _header(const uint8_t* data, size_t len) {
+            if (len == 0) return 0;
+            m_argnum = data[0];
+            if (m_argnum == 0) m_state = stream_done;
+            return 1;
+        }
+
+        //读取定长数值，数据不足返回false
+        template <arithmetic T>
+        bool _read(const uint8_t* data, size_t len, size_t& pos, T& val) {
+            if (len - pos < sizeof(T)) return false;
+            memcpy(&val, data + pos, sizeof(T));
+            pos += sizeof(T);
+            return true;
+        }
+
+        //读取varint，数据不足返回false，超长时置错误
+        bool _varint(const uint8_t* data, size_t len, size_t& pos, uint64_t& val) {
+            size_t n = varint_decode(data + pos, len - pos, &val);
+            if (n == 0) {
+                if (len - pos >= VARINT_MAX) _fail("stream decode varint is too long");
+                return false;
+            }
+            pos += n;
+            return true;
+        }
+
+        //解析一个token，返回消耗的字节数，数据不足或出错返回0
+        size_t _token(const uint8_t* data, size_t len) {
+            if (len == 0) return 0;
+            if (!lua_checkstack(m_co, 4)) {
+                _fail("stream decode stack overflow");
+                return 0;
+            }
+            size_t pos = 1;
+            uint8_t type = data[0];
+            //键位置的type_tab_tail表示表结束，值位置为扩展类型
+            if (type == type_tab_tail && _at_key()) {
+                return _close() ? pos : 0;
+            }
+            if (type == type_ext) {
+                if (len < 2) return 0;
+                pos = 2;
+            }
+            if (m_tabdef && type != type_tab_head && !(type == type_ext && ext_table(data[1]))) {
+                _fail("stream decode table define has no table");
+                return 0;
+            }
+            if (m_session && (type == type_istring || type == type_strindex)) {
+                _fail("stream decode doesn't support session dict");
+                return 0;
+            }
+            switch (type) {
+            case type_nil:
+                lua_pushnil(m_co);
+                break;
+            case type_true:
+                lua_pushboolean(m_co, true);
+                break;
+            case type_false:
+                lua_pushboolean(m_co, false);
+                break;
+            case type_undefine:
+                lua_pushstring(m_co, "undefine");
+                break;
+            case type_number: {
+                double val;
+                if (!_read(data, len, pos, val)) return 0;
+                lua_pushnumber(m_co, val);
+                break;
+            }
+            case type_int16: {
+                int16_t val;
+                if (!_read(data, len, pos, val)) return 0;
+                lua_pushinteger(m_co, val);
+                break;
+            }
+            case type_int32: {
+                int32_t val;
+                if (!_read(data, len, pos, val)) return 0;
+                lua_pushinteger(m_co, val);
+                break;
+            }
+            case type_int64: {
+                int64_t val;
+                if (!_read(data, len, pos, val)) return 0;
+                lua_pushinteger(m_co, val);
+                break;
+            }
+            case type_string8:
+            case type_istring: {
+                uint8_t sz;
+                if (!_read(data, len, pos, sz) || !_string(data, len, pos, sz, type == type_istring)) return 0;
+                break;
+            }
+            case type_string16: {
+                uint16_t sz;
+                if (!_read(data, len, pos, sz) || !_string(data, len, pos, sz, false)) return 0;
+                break;
+            }
+            case type_string32: {
+                uint32_t sz;
+                if (!_read(data, len, pos, sz)) return 0;
+                if (sz > max_string_size) {
+                    _fail("stream decode string is out of range");
+                    return 0;
+                }
+                if (!_string(data, len, pos, sz, false)) return 0;
+                break;
+            }
+            case type_strindex: {
+                uint8_t index;
+                if (!_read(data, len, pos, index)) return 0;
+                if (index >= m_shares.size()) {
+                    _fail("stream decode string index is out of range");
+                    return 0;
+                }
+                lua_pushlstring(m_co, m_shares[index].data(), m_shares[index].size());
+                break;
+            }
+            case type_tab_head:
+                return _open(frame_type::map, 8, pos);
+            case type_ext:
+                return _ext(data, len, pos);
+            default:
+                lua_pushinteger(m_co, type - type_max);
+                break;
+            }
+            return _complete() ? pos : 0;
+        }
+
+        bool _at_key() {
+            return !m_frames.empty() && m_frames.back().type == frame_type::map && !m_frames.back().value;
+        }
+
+        //扩展类型，pos已跳过子类型
+        size_t _ext(const uint8_t* data, size_t len, size_t pos) {
+            switch (data[1]) {
+            case ext_map: {
+                uint8_t exp;
+                if (!_read(data, len, pos, exp)) return 0;
+                size_t nrec = std::min<size_t>((size_t)1 << std::min(exp, max_size_hint), max_stream_presize);
+                return _open(frame_type::map, nrec, pos);
+            }
+            case ext_array: {
+                uint64_t count;
+                if (!_varint(data, len, pos, count)) return 0;
+                lua_createtable(m_co, (int)std::min<uint64_t>(count, max_stream_presize), 0);
+                if (m_tabdef) _define();
+                if (count == 0) return _complete() ? pos : 0;
+                return _push_frame({ frame_type::array, lua_gettop(m_co), count }) ? pos : 0;
+            }
+            case ext_record: {
+                uint64_t id;
+                if (!_varint(data, len, pos, id)) return 0;
+                return _record(id) ? pos : 0;
+            }
+            case ext_tabdef:
+                m_tabdef = true;
+                return pos;
+            case ext_tabref: {
+                uint64_t index;
+                if (!_varint(data, len, pos, index)) return 0;
+                if (index >= m_tabdefs) {
+                    _fail("stream decode table reference is out of range");
+                    return 0;
+                }
+                lua_rawgetp(m_co, LUA_REGISTRYINDEX, this);
+                lua_rawgeti(m_co, -1, (lua_Integer)index + 1);
+                lua_remove(m_co, -2);
+                return _complete() ? pos : 0;
+            }
+            }
+            _fail("stream decode extend type is invalid");
+            return 0;
+        }
+
+        bool _string(const uint8_t* data, size_t len, size_t& pos, size_t sz, bool share) {
+            if (len - pos < sz) return false;
+            cpchar str = (cpchar)data + pos;
+            if (share) m_shares.emplace_back(str, sz);
+            lua_pushlstring(m_co, str, sz);
+            pos += sz;
+            return true;
+        }
+
+        bool _push_frame(frame&& f) {
+            if (m_frames.size() >= max_stream_depth) {
+                _fail("stream decode table is too depth");
+                return false;
+            }
+            m_frames.push_back(f);
+            return true;
+        }
+
+        //登记栈顶刚创建的表
+        void _define() {
+            m_tabdef = false;
+            if (m_tabdefs == 0) {
+                lua_createtable(m_co, 8, 0);
+                lua_rawsetp(m_co, LUA_REGISTRYINDEX, this);
+            }
+            lua_rawgetp(m_co, LUA_REGISTRYINDEX, this);
+            lua_pushvalue(m_co, -2);
+            lua_rawseti(m_co, -2, ++m_tabdefs);
+            lua_pop(m_co, 1);
+        }
+
+        size_t _open(frame_type type, size_t nrec, size_t pos) {
+            lua_createtable(m_co, 0, (int)nrec);
+            if (m_tabdef) _define();
+            return _push_frame({ type, lua_gettop(m_co), 0 }) ? pos : 0;
+        }
+
+        //结构：栈上依次为元表、字段信息表、结果表
+        bool _record(uint64_t id) {
+            push_schema_registry(m_co);
+            if (id > UINT32_MAX || lua_rawgeti(m_co, -1, (lua_Integer)id) != LUA_TTABLE) {
+                lua_pop(m_co, 2);
+                _fail("stream decode schema is not registered");
+                return false;
+            }
+            lua_remove(m_co, -2);
+            lua_rawgetp(m_co, -1, &schema_registry);
+            size_t count = lua_rawlen(m_co, -1);
+            lua_createtable(m_co, 0, (int)std::min(count, max_stream_presize));
+            if (m_tabdef) _define();
+            if (count == 0) return _finish_record();
+            return _push_frame({ frame_type::record, lua_gettop(m_co), count });
+        }
+
+        bool _finish_record() {
+            int table = lua_gettop(m_co);
+            lua_pushvalue(m_co, table - 2);
+            lua_setmetatable(m_co, table);
+            lua_replace(m_co, table - 2);
+            lua_settop(m_co, table - 2);
+            return _complete();
+        }
+
+        bool _close() {
+            m_frames.pop_back();
+            return _complete();
+        }
+
+        //栈顶的值已完整，填入所属的表
+        bool _complete() {
+            while (!m_frames.empty()) {
+                frame& f = m_frames.back();
+                if (f.type == frame_type::map) {
+                    if (!f.value) {
+                        f.value = true;
+                        return true;
+                    }
+                    f.value = false;
+                    if (lua_isnil(m_co, -2) || (lua_type(m_co, -2) == LUA_TNUMBER && lua_tonumber(m_co, -2) != lua_tonumber(m_co, -2))) {
+                        _fail("stream decode table key is nil or nan");
+                        return false;
+                    }
+                    lua_rawset(m_co, f.table);
+                    return true;
+                }
+                if (f.type == frame_type::array) {
+                    lua_rawseti(m_co, f.table, ++f.index);
+                    if (f.index < f.count) return true;
+                    m_frames.pop_back();
+                    continue;
+                }
+                //结构：nil字段不写入
+                f.index++;
+                if (lua_isnil(m_co, -1)) {
+                    lua_pop(m_co, 1);
+                } else {
+                    lua_rawgeti(m_co, f.table - 1, f.index);
+                    lua_insert(m_co, -2);
+                    lua_rawset(m_co, f.table);
+                }
+                if (f.index < f.count) return true;
+                m_frames.pop_back();
+                return _finish_record();
+            }
+            if (++m_values == m_argnum) {
+                m_state = stream_done;
+            }
+            return true;
+        }
+
+    private:
+        int m_ref = LUA_NOREF;
+        int m_argnum = -1;
+        int m_values = 0;
+        int m_state = stream_more;
+        bool m_tabdef = false;
+        uint32_t m_tabdefs = 0;     //引用模式已登记的表，存放在注册表[this]
+        bool m_session = false;     //数据来自会话字典模式的连接
+        lua_State* m_co = nullptr;
+        luabuf m_buf;
+        std::string m_err;
+        std::vector<frame> m_frames;
+        std::vector<std::string> m_shares;
+    };
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <memory>
+
+#include "lua_stack.h"
+
+namespace luakit {
+
+    const cpchar VIEW_META = "luakit.view";
+
+    //slice与其视图共享的守卫，slice析构时置空gen，视图不再访问已释放的slice
+    struct view_guard {
+        uint32_t* gen = nullptr;
+    };
+    using view_guard_ptr = std::shared_ptr<view_guard>;
+
+    //指向slice内存的只读视图，不生成lua字符串
+    //slice重新绑定/缓冲区整理/析构后视图失效
+    struct slice_view {
+        view_guard_ptr guard;
+        uint32_t gen = 0;
+        cpchar data = nullptr;
+        size_t len = 0;
+
+        inline bool valid() {
+            if (!guard) return true;
+            return guard->gen != nullptr && *guard->gen == gen;
+        }
+    };
+
+    inline slice_view* lua_check_view(lua_State* L, int idx) {
+        slice_view* view = (slice_view*)luaL_checkudata(L, idx, VIEW_META);
+        if (!view->valid()) {
+            luaL_error(L, "slice view is expired");
+        }
+        return view;
+    }
+
+    //获取字符串或者视图的内容
+    inline vstring lua_view_string(lua_State* L, int idx) {
+        if (lua_type(L, idx) == LUA_TSTRING) {
+            size_t len;
+            cpchar str = lua_tolstring(L, idx, &len);
+            return vstring(str, len);
+        }
+        slice_view* view = lua_check_view(L, idx);
+        return vstring(view->data, view->len);
+    }
+
+    //与string.sub相同的下标规则，起点转换为[0, len]区间的偏移
+    inline size_t lua_view_start(lua_Integer pos, size_t len) {
+        if (pos > 0) return std::min((size_t)pos - 1, len);
+        if (pos == 0 || (size_t)0 - (size_t)pos > len) return 0;
+        return len + pos;
+    }
+
+    //终点(含)转换为[0, len]区间的结束偏移(不含)，小于起点时为空区间
+    inline size_t lua_view_stop(lua_Integer pos, size_t len) {
+        if (pos > 0) return std::min((size_t)pos, len);
+        if (pos == 0 || (size_t)0 - (size_t)pos > len) return 0;
+        return len + pos + 1;
+    }
+
+    //读取pos处(从1开始)的size字节
+    inline cpchar lua_view_at(lua_State* L, slice_view* view, size_t size) {
+        lua_Integer pos = luaL_optinteger(L, 2, 1);
+        if (pos < 1 || (size_t)pos - 1 + size > view->len) {
+            luaL_error(L, "slice view read out of range");
+        }
+        return view->data + pos - 1;
+    }
+
+    void lua_push_view(lua_State* L, int owner, const view_guard_ptr& guard, cpchar data, size_t len);
+
+    inline int lua_view_len(lua_State* L) {
+        slice_view* view = lua_check_view(L, 1);
+        lua_pushinteger(L, view->len);
+        return 1;
+    }
+
+    inline int lua_view_valid(lua_State* L) {
+        slice_view* view = (slice_view*)luaL_checkudata(L, 1, VIEW_META);
+        lua_pushboolean(L, view->valid());
+        return 1;
+    }
+
+    inline int lua_view_tostring(lua_State* L) {
+        slice_view* view = lua_check_view(L, 1);
+        lua_pushlstring(L, view->data, view->len);
+        return 1;
+    }
+
+    inline int lua_view_byte(lua_State* L) {
+        slice_view* view = lua_check_view(L, 1);
+        lua_Integer i = luaL_optinteger(L, 2, 1);
+        size_t start = lua_view_start(i, view->len);
+        size_t stop = lua_view_stop(luaL_optinteger(L, 3, i), view->len);
+        if (start >= stop) return 0;
+        int count = (int)(stop - start);
+        luaL_checkstack(L, count, "slice view byte too many results");
+        for (size_t pos = start; pos < stop; ++pos) {
+            lua_pushinteger(L, (uint8_t)view->data[pos]);
+        }
+        return count;
+    }
+
+    inline int lua_view_sub(lua_State* L) {
+        slice_view* view = lua_check_view(L, 1);
+        size_t start = lua_view_start(luaL_optinteger(L, 2, 1), view->len);
+        size_t stop = lua_view_stop(luaL_optinteger(L, 3, -1), view->len);
+        size_t len = (start < stop) ? stop - start : 0;
+        lua_getiuservalue(L, 1, 1);
+        lua_push_view(L, -1, view->guard, view->data + start, len);
+        return 1;
+    }
+
+    //纯文本查找，返回起止位置
+    inline int lua_view_find(lua_State* L) {
+        slice_view* view = lua_check_view(L, 1);
+        vstring pattern = lua_view_string(L, 2);
+        lua_Integer i = luaL_optinteger(L, 3, 1);
+        if (i > 0 && (size_t)i - 1 > view->len) return 0;
+        size_t init = lua_view_start(i, view->len);
+        size_t pos = vstring(view->data, view->len).find(pattern, init);
+        if (pos == vstring::npos) return 0;
+        lua_pushinteger(L, pos + 1);
+        lua_pushinteger(L, pos + pattern.size());
+        return 2;
+    }
+
+    inline int lua_view_equal(lua_State* L) {
+        slice_view* view = lua_check_view(L, 1);
+        lua_pushboolean(L, vstring(view->data, view->len) == lua_view_string(L, 2));
+        return 1;
+    }
+
+    inline int lua_view_lt(lua_State* L) {
+        lua_pushboolean(L, lua_view_string(L, 1) < lua_view_string(L, 2));
+        return 1;
+    }
+
+    inline int lua_view_le(lua_State* L) {
+        lua_pushboolean(L, lua_view_string(L, 1) <= lua_view_string(L, 2));
+        return 1;
+    }
+
+    //v:int(pos, size, big)，size为1/2/4/8
+    template <bool is_signed>
+    inline int lua_view_integer(lua_State* L) {
+        slice_view* view = lua_check_view(L, 1);
+        size_t size = luaL_optinteger(L, 3, 4);
+        if (size != 1 && size != 2 && size != 4 && size != 8) {
+            luaL_error(L, "slice view integer size must be 1/2/4/8");
+        }
+        cpchar data = lua_view_at(L, view, size);
+        uint64_t val = 0;
+        memcpy(&val, data, size);
+        if (lua_toboolean(L, 4)) {
+            val = byteswap(val) >> (64 - size * 8);
+        }
+        if (is_signed && size < 8) {
+            uint64_t sign = (uint64_t)1 << (size * 8 - 1);
+            val = (val ^ sign) - sign;
+        }
+        lua_pushinteger(L, (lua_Integer)val);
+        return 1;
+    }
+
+    template <std::floating_point T>
+    inline int lua_view_number(lua_State* L) {
+        slice_view* view = lua_check_view(L, 1);
+        cpchar data = lua_view_at(L, view, sizeof(T));
+        std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t> bits;
+        memcpy(&bits, data, sizeof(T));
+        if (lua_toboolean(L, 3)) {
+            bits = byteswap(bits);
+        }
+        T val;
+        memcpy(&val, &bits, sizeof(T));
+        lua_pushnumber(L, val);
+        return 1;
+    }
+
+    inline int lua_view_gc(lua_State* L) {
+        slice_view* view = (slice_view*)luaL_checkudata(L, 1, VIEW_META);
+        view->~slice_view();
+        return 0;
+    }
+
+    inline void lua_push_view(lua_State* L, int owner, const view_guard_ptr& guard, cpchar data, size_t len) {
+        owner = lua_absindex(L, owner);
+        slice_view* view = new (lua_newuserdatauv(L, sizeof(slice_view), 1)) slice_view();
+        view->gen = guard ? *guard->gen : 0;
+        view->guard = guard;
+        view->data = data;
+        view->len = len;
+        //持有所属对象，避免lua管理的slice先被回收
+        lua_pushvalue(L, owner);
+        lua_setiuservalue(L, -2, 1);
+        if (luaL_newmetatable(L, VIEW_META)) {
+            luaL_Reg meta[] = {
+                { "len", lua_view_len },
+                { "sub", lua_view_sub },
+                { "byte", lua_view_byte },
+                { "find", lua_view_find },
+                { "valid", lua_view_valid },
+                { "equal", lua_view_equal },
+                { "string", lua_view_tostring },
+                { "int", lua_view_integer<true> },
+                { "uint", lua_view_integer<false> },
+                { "float", lua_view_number<float> },
+                { "double", lua_view_number<double> },
+                { "__le", lua_view_le },
+                { "__lt", lua_view_lt },
+                { "__eq", lua_view_equal },
+                { "__gc", lua_view_gc },
+                { "__len", lua_view_len },
+                { "__tostring", lua_view_tostring },
+                { NULL, NULL }
+            };
+            luaL_setfuncs(L, meta, 0);
+            lua_pushvalue(L, -1);
+            lua_setfield(L, -2, "__index");
+        }
+        lua_setmetatable(L, -2);
+    }
+}
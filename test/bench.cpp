@@ -0,0 +1,102 @@
+#include "lua_kit.h"
+#include "test_case.h"
+
+#include <chrono>
+
+using namespace luakit;
+
+//编码：单条记录含不同数量的字符串键，值为整数
+static const char* BENCH_ENCODE_SCRIPT = R"LUA(
+    for _, fields in ipairs({ 10, 50, 200 }) do
+        local rec = {}
+        for i = 1, fields do
+            rec["field_" .. i] = i
+        end
+        local count = 0
+        local start = os.clock()
+        while os.clock() - start < 1 do
+            for _ = 1, 100 do
+                luakit.encode(rec)
+            end
+            count = count + 100
+        end
+        print(string.format("bench encode fields %3d: %8.1fK msg/s", fields, count / (os.clock() - start) / 1000))
+    end
+)LUA";
+
+static void bench_encode() {
+    kit_state kit;
+    kit.run_script(BENCH_ENCODE_SCRIPT, [](std::string_view err) {
+        printf("bench_encode error: %s\n", err.data());
+    });
+    kit.close();
+}
+
+//校验：crc32c(运行时选择crc指令)与查表实现的吞吐
+static void bench_crc() {
+    std::vector<uint8_t> data(1 << 20);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = (uint8_t)(i * 131);
+    auto run = [&](cpchar name, auto fn) {
+        uint32_t crc = 0;
+        size_t bytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed {};
+        while (elapsed.count() < 1) {
+            crc += fn(data.data(), data.size());
+            bytes += data.size();
+            elapsed = std::chrono::steady_clock::now() - start;
+        }
+        printf("bench crc32c %-6s: %8.2f GB/s (%08x)\n", name, bytes / elapsed.count() / 1e9, crc);
+    };
+    run("auto", [](const uint8_t* p, size_t n) { return crc32c(p, n); });
+    run("table", [](const uint8_t* p, size_t n) { return ~crc32c_soft(~0u, p, n); });
+}
+
+//两阶段解码：300个嵌套结构的消息，对比decode与parse/materialize的耗时
+static const char* BENCH_DOM_SCRIPT = R"LUA(
+    local meta = luakit.schema(1, { "id", "name", "level", "pos", "tags", "items" })
+    local players = {}
+    for i = 1, 300 do
+        players[i] = setmetatable({
+            id = i, name = "player_" .. i, level = i % 60, pos = { x = i * 1.5, y = -i },
+            tags = { "vip", "guild_" .. (i % 7) }, items = { [1001] = i, [1002] = "sword" },
+        }, meta)
+    end
+    bench_msg = luakit.encode({ players = players, zone = "east", time = 123456 })
+)LUA";
+
+static void bench_dom() {
+    kit_state kit;
+    kit.run_script(BENCH_DOM_SCRIPT, [](std::string_view err) {
+        printf("bench_dom error: %s\n", err.data());
+    });
+    std::string msg = kit.get<std::string>("bench_msg");
+    lua_State* L = kit.L();
+    schema_fields schemas = { { 1, 6 } };
+    const size_t runs = 3000;
+    auto timing = [&](cpchar name, auto fn) {
+        lua_gc(L, LUA_GCCOLLECT, 0);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < runs; ++i) {
+            fn();
+            lua_settop(L, 0);
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        printf("bench dom %-12s: %8.1fms (%zu bytes x %zu)\n", name, elapsed.count(), msg.size(), runs);
+    };
+    timing("decode", [&] {
+        slice mslice((uint8_t*)msg.data(), msg.size());
+        decode_slice(L, &mslice);
+    });
+    dom_doc doc;
+    timing("parse", [&] { doc.parse((const uint8_t*)msg.data(), msg.size(), &schemas); });
+    timing("materialize", [&] { doc.materialize(L); });
+    kit.close();
+}
+
+//性能基准，设置环境变量LUAKIT_BENCH时由main调用
+void run_bench() {
+    bench_encode();
+    bench_crc();
+    bench_dom();
+}
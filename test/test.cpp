@@ -1,4 +1,6 @@
 #include "lua_kit.h"
+#include "test_case.h"
+#include <list>
 #include <array>
 #include <unordered_map>
 
@@ -28,14 +30,31 @@ public:
     }
 };
 
-luakit::variadic_results test_lua_func(lua_State* L, int a, int b) {
-    auto kit_state = luakit::kit_state(L);
+int test_lua_func(lua_State* L) {
+    int a = (int)lua_tointeger(L, 1);
+    int b = (int)lua_tointeger(L, 2);
     printf("call test_lua_func: %d, %d\n", a, b);
-    return kit_state.as_return(true, a + b, "sssss");
+    return luakit::variadic_return(L, true, a + b, "sssss");
 }
 
 int main()
 {
+    test_chain();
+    test_buff();
+    test_ring();
+    test_mmap();
+    test_view();
+    test_slice();
+    test_fdio();
+    test_codec();
+    test_lz();
+    test_crc();
+    test_serialize();
+    printf("test cases fails: %d\n", g_test_fails);
+    if (getenv("LUAKIT_BENCH")) {
+        run_bench();
+    }
+
     auto kit_state = luakit::kit_state();
 
     kit_state.set<uint32_t>("test_value", 12345);
@@ -88,8 +107,8 @@ int main()
     auto lmap = unordered_map<int, string>{ {1, "s"},{2, "a"}, {3, "v"}};
     kit_state.set("lmap", lmap);
 
-    kit_state.run_file("test.lua", [](std::string err) {
-        printf("run_file failed: %s\n", err.c_str());
+    kit_state.run_file("test.lua", [](std::string_view err) {
+        printf("run_file failed: %.*s\n", (int)err.size(), err.data());
         });
 
     printf("view test_func: %d\n", lv);
@@ -110,11 +129,11 @@ int main()
     bool r = kit_state.table_call("testtb", "lua_tcall2", nullptr, std::tie(ar, br), 3, 4, "lua string");
     printf("call lua_tcall2: %d, %d\n", ar, br);
 
-    kit_state.run_script("print(test_value)", [](std::string err) {
-        printf("run_script failed: %s\n", err.c_str());
+    kit_state.run_script("print(test_value)", [](std::string_view err) {
+        printf("run_script failed: %.*s\n", (int)err.size(), err.data());
         });
 
-    list<int> lvec2 = kit_state.get<luakit::reference>("lvec2").to_sequence<list<int>, int>();
+    list<int> lvec2 = kit_state.get<list<int>>("lvec2");
     for (auto it : lvec2) {
         printf("view vector: %d\n", it);
     }
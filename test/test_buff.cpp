@@ -0,0 +1,102 @@
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "lua_buff.h"
+#include "test_case.h"
+
+using namespace luakit;
+
+//内存池：缩小后再扩大命中缓存的块，trim和budget释放缓存
+static void test_buff_pool() {
+    size_pool* pool = thread_pool();
+    TEST_CHECK(pool != nullptr);
+    if (!pool) return;
+    pool->trim(0);
+    std::vector<uint8_t> data(BUFFER_DEF * 8, 1);
+    luabuf buf, other;
+    buf.push_data(data.data(), data.size());
+    buf.reset();
+    TEST_CHECK(pool->cached() >= BUFFER_DEF * 8);
+    size_t hits = pool->hits();
+    buf.push_data(data.data(), data.size());
+    TEST_CHECK(pool->hits() > hits);
+    //两个buff同时扩容再缩小，同一规格缓存两块
+    other.push_data(data.data(), data.size());
+    buf.reset();
+    other.reset();
+    size_t cached = pool->cached();
+    pool->set_budget(0);
+    TEST_CHECK(pool->cached() < cached);
+    //budget为0时每个规格最多保留1块
+    size_t limit = 0;
+    for (size_t i = 0; i < POOL_CLASS; ++i) limit += BUFFER_DEF << i;
+    TEST_CHECK(pool->cached() <= limit);
+    cached = pool->cached();
+    TEST_CHECK(pool->trim(BUFFER_DEF) + BUFFER_DEF >= cached);
+    TEST_CHECK(pool->cached() <= BUFFER_DEF);
+    size_t left = pool->cached();
+    TEST_CHECK(pool->trim(0) == left && pool->cached() == 0);
+    pool->set_budget(POOL_BUDGET);
+}
+
+#ifndef WIN32
+//slice的子类走erase版本的consume_iov
+class part_slice : public slice {
+public:
+    using slice::slice;
+};
+
+static std::string iov_string(iovec* iov, size_t n) {
+    std::string out;
+    for (size_t i = 0; i < n; ++i) out.append((cpchar)iov[i].iov_base, iov[i].iov_len);
+    return out;
+}
+
+//多个buff/slice导出iovec，writev/readv经过管道，consume_iov按顺序消费
+static void test_buff_iov() {
+    int fds[2];
+    TEST_CHECK(pipe(fds) == 0);
+    luabuf buf;
+    buf.push_data((cpbyte)"head-", 5);
+    uint8_t body[] = "body-";
+    slice sbody(body, 5);
+    uint8_t tail[] = "tail";
+    part_slice stail(tail, 4);
+    iovec iov[8] = {};
+    size_t n = gather_iov(iov, 8, &buf, &sbody, &stail);
+    TEST_CHECK(n == 3 && iov_string(iov, n) == "head-body-tail");
+    //空间不足时只导出前面的部分
+    TEST_CHECK(gather_iov(iov, 2, &buf, &sbody, &stail) == 2);
+
+    ssize_t len = writev(fds[1], iov, (int)n);
+    TEST_CHECK(len == 14);
+    //部分发送：消费到第二段中间
+    TEST_CHECK(consume_iov(7, &buf, &sbody, &stail) == 0);
+    TEST_CHECK(buf.empty() && sbody.size() == 3 && stail.size() == 4);
+    TEST_CHECK(consume_iov(len - 7, &buf, &sbody, &stail) == 0);
+    TEST_CHECK(sbody.empty() && stail.empty());
+    //超出的长度原样返回
+    TEST_CHECK(consume_iov(3, &buf, &sbody, &stail) == 3);
+
+    luabuf in;
+    iovec riov[4] = {};
+    size_t rn = in.space_iov(riov, 4, 14);
+    TEST_CHECK(rn >= 1 && riov[0].iov_len >= 14);
+    len = readv(fds[0], riov, (int)rn);
+    TEST_CHECK(len == 14);
+    in.pop_space(len);
+    TEST_CHECK(std::string((cpchar)in.head(), in.size()) == "head-body-tail");
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
+void test_buff() {
+    test_buff_pool();
+#ifndef WIN32
+    test_buff_iov();
+#endif
+    printf("test_buff done\n");
+}
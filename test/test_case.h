@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdio>
+
+//简单断言：失败时打印位置并计数，不中断后续用例
+inline int g_test_fails = 0;
+
+#define TEST_CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            g_test_fails++; \
+            printf("check failed: %s (%s:%d)\n", #cond, __FILE__, __LINE__); \
+        } \
+    } while (0)
+
+//各模块的用例，在test.cpp的main中调用
+void test_chain();
+void test_buff();
+void test_ring();
+void test_mmap();
+void test_view();
+void test_slice();
+void test_fdio();
+void test_codec();
+void test_lz();
+void test_crc();
+void test_serialize();
+
+//性能基准，不计入用例
+void run_bench();
@@ -0,0 +1,117 @@
+#include "lua_chain.h"
+#include "test_case.h"
+
+using namespace luakit;
+
+static uint8_t chain_byte(size_t i) {
+    return (uint8_t)(i * 31 + i / 7);
+}
+
+//追加跨过块边界，按原顺序读出
+static void test_chain_push() {
+    chain_buf chain;
+    std::vector<uint8_t> data(BLOCK_SIZE * 3 + 100);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = chain_byte(i);
+    size_t pos = 0;
+    for (size_t len : { (size_t)10, BLOCK_SIZE - 20, (size_t)30, BLOCK_SIZE * 2 + 80 }) {
+        TEST_CHECK(chain.push_data(data.data() + pos, len) == len);
+        pos += len;
+    }
+    TEST_CHECK(chain.size() == data.size() && chain.block_count() == 4);
+    std::vector<uint8_t> out(data.size());
+    TEST_CHECK(chain.pop_data(out.data(), 5) == 5);
+    TEST_CHECK(chain.pop_data(out.data() + 5, out.size() - 5) == out.size() - 5);
+    TEST_CHECK(out == data && chain.empty());
+    TEST_CHECK(chain.pop_data(out.data(), 1) == 0);
+}
+
+//peek_data/get_slice跨块时合并为连续内存，合并前后读出的数据一致
+static void test_chain_peek() {
+    chain_buf chain;
+    std::vector<uint8_t> data(BLOCK_SIZE * 3);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = chain_byte(i);
+    chain.push_data(data.data(), data.size());
+    TEST_CHECK(chain.block_count() == 3);
+    //块内不需要合并
+    uint8_t* inner = chain.peek_data(100, 10);
+    TEST_CHECK(inner && memcmp(inner, data.data() + 10, 100) == 0 && chain.block_count() == 3);
+    //从第一块中间跨到第二块
+    size_t offset = BLOCK_SIZE - 50;
+    uint8_t* cross = chain.peek_data(200, offset);
+    TEST_CHECK(cross && memcmp(cross, data.data() + offset, 200) == 0);
+    slice* s = chain.get_slice(BLOCK_SIZE, BLOCK_SIZE / 2);
+    TEST_CHECK(s->size() == BLOCK_SIZE && memcmp(s->head(), data.data() + BLOCK_SIZE / 2, BLOCK_SIZE) == 0);
+    TEST_CHECK(chain.peek_data(1, data.size()) == nullptr && chain.peek_data(data.size() + 1) == nullptr);
+    size_t len = 0;
+    uint8_t* all = chain.data(&len);
+    TEST_CHECK(len == data.size() && memcmp(all, data.data(), len) == 0 && chain.block_count() == 1);
+    TEST_CHECK(chain.read<uint32_t>() == *(uint32_t*)data.data());
+    TEST_CHECK(chain.size() == data.size() - sizeof(uint32_t));
+}
+
+//pop_size读空的块归还t_blocks，再追加时复用
+static void test_chain_pool() {
+    chain_buf chain;
+    std::vector<uint8_t> data(BLOCK_SIZE * 4, 1);
+    size_t cached = t_blocks.count();
+    chain.push_data(data.data(), data.size());
+    TEST_CHECK(chain.block_count() == 4);
+    TEST_CHECK(t_blocks.count() == cached - std::min<size_t>(cached, 4));
+    size_t before = t_blocks.count();
+    TEST_CHECK(chain.pop_size(BLOCK_SIZE * 2 + 10) == BLOCK_SIZE * 2 + 10);
+    TEST_CHECK(t_blocks.count() == before + 2 && chain.block_count() == 2);
+    TEST_CHECK(chain.pop_size(data.size()) == 0);
+    chain.push_data(data.data(), BLOCK_SIZE);
+    TEST_CHECK(t_blocks.count() == before + 1);
+    chain.reset();
+    TEST_CHECK(t_blocks.count() == before + 4);
+}
+
+//总长度超过BUFFER_MAX：luabuf会失败，chain_buf按块继续追加
+static void test_chain_large() {
+    chain_buf chain;
+    std::vector<uint8_t> data(1024 * 1024);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = chain_byte(i);
+    size_t total = BUFFER_MAX + data.size();
+    for (size_t pos = 0; pos < total; pos += data.size()) {
+        TEST_CHECK(chain.push_data(data.data(), data.size()) == data.size());
+    }
+    TEST_CHECK(chain.size() == total);
+    TEST_CHECK(chain.block_count() == total / BLOCK_SIZE);
+    std::vector<uint8_t> out(data.size());
+    bool same = true;
+    while (!chain.empty()) {
+        same = same && chain.pop_data(out.data(), out.size()) == out.size() && out == data;
+    }
+    TEST_CHECK(same && chain.block_count() == 1);
+    TEST_CHECK(t_blocks.count() <= BLOCK_CACHE);
+}
+
+//peek_space/space_iov预留后提交，可以跨块
+static void test_chain_space() {
+    chain_buf chain;
+    chain.push_data((cpbyte)"abc", 3);
+    uint8_t* space = chain.peek_space(10);
+    TEST_CHECK(space != nullptr);
+    memcpy(space, "defghijklm", 10);
+    TEST_CHECK(chain.pop_space(10) == 10 && chain.string() == "abcdefghijklm");
+    iovec iov[4] = {};
+    size_t n = chain.space_iov(iov, 4, BLOCK_SIZE * 2);
+    size_t total = 0;
+    for (size_t i = 0; i < n; ++i) total += iov[i].iov_len;
+    TEST_CHECK(n >= 2 && total >= BLOCK_SIZE * 2);
+    size_t fill = iov[0].iov_len + 5;
+    memset(iov[0].iov_base, 'x', iov[0].iov_len);
+    memset(iov[1].iov_base, 'y', 5);
+    TEST_CHECK(chain.pop_space(fill) == fill && chain.size() == 13 + fill);
+    TEST_CHECK(chain.peek_data(1, chain.size() - 1)[0] == 'y');
+}
+
+void test_chain() {
+    test_chain_push();
+    test_chain_peek();
+    test_chain_pool();
+    test_chain_large();
+    test_chain_space();
+    printf("test_chain done\n");
+}
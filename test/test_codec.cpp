@@ -0,0 +1,434 @@
+#include "lua_kit.h"
+#include "test_case.h"
+
+using namespace luakit;
+
+static void run_check(kit_state& kit, cpchar script) {
+    TEST_CHECK(kit.run_script(script, [](std::string_view err) {
+        printf("test_codec error: %s\n", err.data());
+    }));
+}
+
+//键字典：长短键混合、超过字典容量、同内容键在多个表中重复出现
+static void test_codec_keys() {
+    kit_state kit;
+    run_check(kit, R"LUA(
+        local rec = {}
+        for i = 1, 300 do
+            local key = (i % 3 == 0) and string.rep("k", 40 + i % 20) .. i or "f" .. i
+            rec[key] = { [key] = i, sub = { [key] = -i } }
+        end
+        local out = luakit.decode(luakit.encode(rec))
+        local n = 0
+        for key, val in pairs(rec) do
+            local o = out[key]
+            assert(o and o[key] == val[key] and o.sub[key] == val.sub[key], key)
+            n = n + 1
+        end
+        for _ in pairs(out) do n = n - 1 end
+        assert(n == 0)
+    )LUA");
+    kit.close();
+}
+
+//类型化解码抛出异常后，t_session不能残留指向codec的会话字典
+static void test_codec_session_scope() {
+    luabuf buf;
+    luacodec codec;
+    codec.set_buff(&buf);
+    codec.enable_session(16);
+    size_t len = 0;
+    uint8_t* data = codec.encode(&len, 2, std::string("name"), 42);
+    std::vector<uint8_t> frame(data, data + len);
+    std::string name;
+    int val = 0;
+    bool thrown = false;
+    try {
+        codec.decode(frame.data(), frame.size(), name);
+    } catch (const std::exception&) {
+        thrown = true;
+    }
+    TEST_CHECK(thrown);
+    TEST_CHECK(t_session == nullptr);
+    //失败的解码已回滚，同一帧可以重新解码
+    codec.decode(frame.data(), frame.size(), name, val);
+    TEST_CHECK(name == "name" && val == 42);
+    TEST_CHECK(t_session == nullptr);
+}
+
+//各解码路径的结果需一致：decode、引用模式、流式逐字节、延迟解码、DOM
+static const char* CODEC_ROUNDTRIP_SCRIPT = R"LUA(
+    local function deep_equal(a, b)
+        if type(a) ~= "table" or type(b) ~= "table" then
+            return a == b
+        end
+        for k, v in pairs(a) do
+            if type(k) ~= "table" and not deep_equal(v, b[k]) then return false end
+        end
+        for k in pairs(b) do
+            if type(k) ~= "table" and a[k] == nil then return false end
+        end
+        return true
+    end
+    local function stream_decode(data)
+        local sd = luakit.stream_decoder()
+        for i = 1, #data do
+            local state = sd.feed(data:sub(i, i))
+            assert(state ~= -1, sd.err())
+        end
+        return sd.results()
+    end
+    local function dom_decode(data)
+        local pool = luakit.dom_pool(1)
+        pool.submit(data)
+        local id, ok, value = pool.wait()
+        assert(ok, value)
+        return value
+    end
+    local meta = luakit.schema(7, { "id", "name", "items" }, { "integer", "string", "table" })
+    local record = setmetatable({ id = 1, name = "r", items = { 1, 2 } }, meta)
+    local partial = setmetatable({ id = 2 }, meta)
+    local extra = setmetatable({ id = 3, name = "x", level = 9 }, meta)
+    local key = { 7, 8 }
+    local values = {
+        {}, { 1, 2, 3 }, { a = 1, b = { 1, { x = "y" } } },
+        { { {}, { {} } }, { [1] = 1, [3] = 3 } },
+        { list = { 1, "s", true, 2.5, { k = {} } }, n = -1 },
+        { [key] = { 1, 2 }, [{}] = "empty" },
+        record, { partial, { extra } },
+    }
+    for i, value in ipairs(values) do
+        for _, encode in ipairs({ luakit.encode, luakit.encode_refs }) do
+            local data = encode(value)
+            for name, decode in pairs({ decode = luakit.decode, stream = stream_decode, dom = dom_decode,
+                    lazy = function(d) return luakit.materialize(luakit.decode_lazy(d)) end }) do
+                local out = decode(data)
+                assert(deep_equal(value, out), name .. " mismatch at " .. i)
+                if value == record then
+                    assert(getmetatable(out) ~= nil, name .. " lost record")
+                elseif i == #values then
+                    --结构之外的字段按普通表编码
+                    assert(getmetatable(out[1]) ~= nil and getmetatable(out[2][1]) == nil, name .. " record fallback")
+                end
+            end
+        end
+    end
+    --表作为键按type_tab_head编码
+    local out = luakit.decode(luakit.encode(values[6]))
+    local found = 0
+    for k, v in pairs(out) do
+        if type(k) == "table" then
+            found = found + 1
+            if #k == 2 then assert(k[1] == 7 and k[2] == 8 and v[2] == 2) else assert(next(k) == nil and v == "empty") end
+        end
+    end
+    assert(found == 2)
+)LUA";
+
+static void test_codec_roundtrip() {
+    kit_state kit;
+    run_check(kit, CODEC_ROUNDTRIP_SCRIPT);
+    kit.close();
+}
+
+//原生容器编码后由lua解码，以及原生解码
+static void test_codec_native() {
+    luabuf buf;
+    luacodec codec;
+    codec.set_buff(&buf);
+    std::vector<int> vec = { 1, 2, 3 };
+    std::map<std::string, std::vector<int>> map = { { "a", { 1 } }, { "b", {} } };
+    size_t len = 0;
+    uint8_t* data = codec.encode(&len, 2, vec, map);
+    std::vector<uint8_t> frame(data, data + len);
+    std::vector<int> vec2;
+    std::map<std::string, std::vector<int>> map2;
+    codec.decode(frame.data(), frame.size(), vec2, map2);
+    TEST_CHECK(vec2 == vec);
+    TEST_CHECK(map2 == map);
+    kit_state kit;
+    kit.set("native_data", std::string((cpchar)frame.data(), frame.size()));
+    run_check(kit, R"LUA(
+        local vec, map = luakit.decode(native_data)
+        assert(#vec == 3 and vec[3] == 3)
+        assert(map.a[1] == 1 and #map.b == 0)
+    )LUA");
+    kit.close();
+}
+
+//原有类型和内联整数的编码不变，旧格式的表仍可解码
+static void test_codec_compat() {
+    kit_state kit;
+    run_check(kit, R"LUA(
+        assert(luakit.encode(0) == "\1\15")
+        assert(luakit.encode(240) == "\1\255")
+        assert(luakit.encode(true) == "\1\1")
+        assert(luakit.encode({}) == "\1\4\0\0")
+        local t = luakit.decode("\1\3\16\17\4")
+        assert(t[1] == 2 and next(t, 1) == nil)
+    )LUA");
+    kit.close();
+}
+
+//引用模式解码失败后不残留登记的表
+static void test_codec_tabref_error() {
+    kit_state kit;
+    run_check(kit, R"LUA(
+        local shared = { 1, 2 }
+        local data = luakit.encode_refs({ shared, shared, { 3 } })
+        local ok = pcall(luakit.decode, data:sub(1, #data - 1))
+        assert(not ok)
+    )LUA");
+    lua_State* L = kit.L();
+    TEST_CHECK(lua_rawgetp(L, LUA_REGISTRYINDEX, &tabref_registry) == LUA_TNIL);
+    lua_pop(L, 1);
+    TEST_CHECK(t_tabdefs == 0 && !t_tabdef);
+    kit.close();
+}
+
+//会话字典模式的帧，流式解码返回错误而不是误解析
+static void test_codec_stream_session() {
+    luabuf buf;
+    luacodec codec;
+    codec.set_buff(&buf);
+    codec.enable_session(16);
+    std::map<std::string, int> map = { { "name", 1 } };
+    size_t len = 0;
+    uint8_t* data = codec.encode(&len, 1, map);
+    kit_state kit;
+    kit.set("session_data", std::string((cpchar)data, len));
+    run_check(kit, R"LUA(
+        local sd = luakit.stream_decoder(true)
+        assert(sd.feed(session_data) == -1 and #sd.err() > 0)
+        sd = luakit.stream_decoder(true)
+        assert(sd.feed(luakit.encode({ 1, 2.5, true })) == 1)
+    )LUA");
+    kit.close();
+}
+
+struct codec_player {
+    int64_t id = 0;
+    std::string name;
+    bool online = false;
+};
+
+namespace luakit {
+    template <> struct lua_reflect<codec_player> {
+        static constexpr uint32_t schema = 21;
+        static constexpr auto fields = std::make_tuple(lua_field("id", &codec_player::id),
+            lua_field("name", &codec_player::name), lua_field("online", &codec_player::online));
+    };
+}
+
+//bool按整数0/1编码，解码兼容boolean；按反射注册结构时检查字段顺序
+static void test_codec_native_schema() {
+    luabuf buf;
+    luacodec codec;
+    codec.set_buff(&buf);
+    size_t len = 0;
+    uint8_t* data = codec.encode(&len, 2, true, false);
+    TEST_CHECK(len == 3 && data[1] == type_max + 1 && data[2] == type_max);
+    kit_state kit;
+    bool online = false, away = true;
+    std::string frame((cpchar)data, len);
+    codec.decode((uint8_t*)frame.data(), frame.size(), online, away);
+    TEST_CHECK(online && !away);
+    kit.set("bool_data", frame);
+    run_check(kit, R"LUA(
+        local a, b = luakit.decode(bool_data)
+        assert(a == 1 and b == 0)
+        lua_bools = luakit.encode(true)
+    )LUA");
+    std::string lua_bools = kit.get<std::string>("lua_bools");
+    codec.decode((uint8_t*)lua_bools.data(), lua_bools.size(), online);
+    TEST_CHECK(online);
+    kit.new_schema<codec_player>();
+    kit.new_schema<codec_player>();
+    codec_player player{ 7, "p", true }, player2;
+    data = codec.encode(&len, 1, player);
+    frame.assign((cpchar)data, len);
+    codec.decode((uint8_t*)frame.data(), frame.size(), player2);
+    TEST_CHECK(player2.id == 7 && player2.name == "p" && player2.online);
+    kit.close();
+
+    kit_state kit2;
+    run_check(kit2, R"LUA(luakit.schema(21, { "name", "id", "online" }))LUA");
+    bool thrown = false;
+    try {
+        kit2.new_schema<codec_player>();
+    } catch (const std::exception&) {
+        thrown = true;
+    }
+    TEST_CHECK(thrown);
+    kit2.close();
+}
+
+//压缩帧解码出的string_view不被之后的编码覆盖；按结构快照跳过未知字段中的结构，包括引用模式下的结构
+static void test_codec_native_decode() {
+    luabuf buf;
+    luacodec codec;
+    codec.set_buff(&buf);
+    codec.enable_compress(16);
+    size_t len = 0;
+    uint8_t* data = codec.encode(&len, 1, std::string(200, 'a'));
+    std::vector<uint8_t> frame(data, data + len);
+    TEST_CHECK(frame.back() == frame_lz);
+    std::string_view view;
+    codec.decode(frame.data(), frame.size(), view);
+    codec.encode(&len, 1, std::string(200, 'b'));
+    TEST_CHECK(view == std::string(200, 'a'));
+    codec.disable_compress();
+
+    kit_state kit;
+    run_check(kit, R"LUA(
+        local meta = luakit.schema(30, { "a", "b" })
+        local rec = setmetatable({ a = 1, b = { 2 } }, meta)
+        local value = { id = 5, extra = rec, name = "n", list = { rec, rec }, online = true }
+        plain_data = luakit.encode(value)
+        refs_data = luakit.encode_refs(value)
+    )LUA");
+    //没有结构快照时无法跳过结构
+    std::string plain = kit.get<std::string>("plain_data");
+    codec_player player;
+    bool thrown = false;
+    try {
+        codec.decode((uint8_t*)plain.data(), plain.size(), player);
+    } catch (const std::exception&) {
+        thrown = true;
+    }
+    TEST_CHECK(thrown);
+    //快照在lua线程生成，解码在其它线程进行
+    codec.set_schemas(kit.schema_snapshot());
+    for (cpchar name : { "plain_data", "refs_data" }) {
+        std::string encoded = kit.get<std::string>(name);
+        std::thread worker([&]() {
+            codec_player player;
+            try {
+                codec.decode((uint8_t*)encoded.data(), encoded.size(), player);
+            } catch (const std::exception& e) {
+                printf("test_codec error: %s\n", e.what());
+            }
+            TEST_CHECK(player.id == 5 && player.name == "n" && player.online);
+        });
+        worker.join();
+    }
+    kit.close();
+}
+
+//延迟解码：整数值的浮点数键按整数查找，map的长度使用整数键索引
+static void test_codec_lazy_keys() {
+    luabuf buf;
+    luacodec codec;
+    codec.set_buff(&buf);
+    std::map<double, int> native = { { 0.5, 1 }, { 2.0, 5 } };
+    size_t len = 0;
+    uint8_t* data = codec.encode(&len, 1, native);
+    kit_state kit;
+    kit.set("native_keys", std::string((cpchar)data, len));
+    run_check(kit, R"LUA(
+        local big = { x = 1 }
+        for i = 1, 20000 do big[i] = i * 2 end
+        big[20002] = 0
+        local p = luakit.decode_lazy(luakit.encode(big))
+        assert(p[2.0] == 4 and p[2] == 4 and p[20000.0] == 40000 and p[1.5] == nil and p.x == 1)
+        assert(#p == 20000 and #p == 20000 and p[20001] == nil)
+        local small = luakit.decode_lazy(luakit.encode({ a = 1, [1] = 5, [2] = 6, [2.5] = 7, [true] = 8 }))
+        assert(small[2.0] == 6 and small[2.5] == 7 and small[true] == 8 and small[3] == nil and #small == 2)
+        local arr = luakit.decode_lazy(luakit.encode({ 10, 20, 30 }))
+        assert(arr[3.0] == 30 and arr[1.5] == nil and arr[0] == nil)
+        local n = luakit.decode_lazy(native_keys)
+        assert(n[2] == 5 and n[0.5] == 1 and n[1] == nil)
+    )LUA");
+    kit.close();
+}
+
+//DOM物化：多个参数的顺序、重复的字符串、结构在提交后被修改
+static void test_codec_dom() {
+    luabuf buf;
+    luacodec codec;
+    codec.set_buff(&buf);
+    size_t len = 0;
+    uint8_t* data = codec.encode(&len, 3, "k", std::vector<std::string>{ "k", "v", "k" }, 5);
+    kit_state kit;
+    kit.set("dom_args", std::string((cpchar)data, len));
+    run_check(kit, R"LUA(
+        local pool = luakit.dom_pool(1)
+        pool.submit(dom_args)
+        local id, ok, a, b, c = pool.wait()
+        assert(ok and a == "k" and c == 5 and #b == 3 and b[1] == "k" and b[2] == "v" and b[3] == "k")
+        local meta = luakit.schema(40, { "a", "b" })
+        local rec = setmetatable({ a = "s", b = "s" }, meta)
+        pool.submit(luakit.encode_refs({ rec, rec, { s = "s" } }))
+        id, ok, a = pool.wait()
+        assert(ok and a[1] == a[2] and getmetatable(a[1]) == meta and a[1].b == "s" and a[3].s == "s")
+        pool.submit(luakit.encode(rec))
+        luakit.schema(40, { "a", "b", "c" })
+        id, ok, a = pool.wait()
+        assert(not ok and a:find("changed"))
+    )LUA");
+    kit.close();
+}
+
+//批量编解码：多个包往返(开启与不开启压缩、校验)，末尾不完整的包留在slice中，包长小于包头时报错
+static void test_codec_batch() {
+    lua_State* L = luaL_newstate();
+    for (int mode = 0; mode < 3; ++mode) {
+        luabuf buf;
+        luacodec codec;
+        codec.set_buff(&buf);
+        if (mode > 0) codec.enable_checksum();
+        if (mode > 1) codec.enable_compress(16);
+        codec.batch_begin();
+        for (int i = 0; i < 4; ++i) {
+            codec.batch_encode(2, i, std::string(10 * i, 'b'));
+        }
+        lua_pushinteger(L, 4);
+        lua_pushstring(L, std::string(40, 'b').c_str());
+        codec.batch_encode(L, 1, 2);
+        lua_settop(L, 0);
+        TEST_CHECK(codec.batch_offsets().size() == 5);
+        size_t len = 0;
+        uint8_t* data = codec.batch_data(&len);
+        std::vector<uint8_t> stream(data, data + len);
+        stream.insert(stream.end(), data, data + codec.batch_offsets()[1] - 1);
+        slice sslice(stream.data(), stream.size());
+        int next = 0;
+        int count = codec.batch_decode(&sslice, [&](slice*) {
+            TEST_CHECK(codec.decode(L) == 2);
+            TEST_CHECK(lua_tointeger(L, 1) == next && lua_rawlen(L, 2) == size_t(10 * next));
+            lua_settop(L, 0);
+            next++;
+        });
+        TEST_CHECK(count == 5 && next == 5);
+        TEST_CHECK(sslice.size() == codec.batch_offsets()[1] - 1);
+    }
+    for (uint32_t bad = 0; bad < sizeof(uint32_t); ++bad) {
+        luabuf buf;
+        luacodec codec;
+        codec.set_buff(&buf);
+        uint8_t packet[16] = {};
+        memcpy(packet, &bad, sizeof(uint32_t));
+        slice sslice(packet, sizeof(packet));
+        bool called = false;
+        TEST_CHECK(codec.batch_decode(&sslice, [&](slice*) { called = true; }) == -1 && !called);
+        codec.set_slice(&sslice);
+        TEST_CHECK(codec.load_packet(sslice.size()) == -1);
+    }
+    lua_close(L);
+}
+
+void test_codec() {
+    test_codec_batch();
+    test_codec_dom();
+    test_codec_lazy_keys();
+    test_codec_native_decode();
+    test_codec_native_schema();
+    test_codec_stream_session();
+    test_codec_compat();
+    test_codec_tabref_error();
+    test_codec_roundtrip();
+    test_codec_native();
+    test_codec_keys();
+    test_codec_session_scope();
+    printf("test_codec done\n");
+}
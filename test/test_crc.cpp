@@ -0,0 +1,65 @@
+#include "lua_kit.h"
+#include "test_case.h"
+
+#include <random>
+
+using namespace luakit;
+
+//标准校验值，分段累加，crc指令与查表的结果一致(不同长度与对齐)
+static void test_crc_value() {
+    TEST_CHECK(crc32c((const uint8_t*)"123456789", 9) == 0xE3069283);
+    TEST_CHECK(crc32c(nullptr, 0) == 0);
+    std::mt19937 rng(3);
+    std::vector<uint8_t> data(4096 + 16);
+    for (auto& c : data) c = (uint8_t)rng();
+    for (size_t i = 0; i < 500; ++i) {
+        size_t off = rng() % 16, len = rng() % 4096, cut = len ? rng() % len : 0;
+        const uint8_t* p = data.data() + off;
+        uint32_t crc = crc32c(p, len);
+        TEST_CHECK(crc == ~crc32c_soft(~0u, p, len));
+        TEST_CHECK(crc == crc32c(p + cut, len - cut, crc32c(p, cut)));
+    }
+}
+
+//load_packet校验过的包体，set_slice后decode不再重复校验；其它数据照常校验
+static void test_crc_packet() {
+    luabuf buf;
+    luacodec codec;
+    codec.set_buff(&buf);
+    codec.enable_checksum();
+    size_t len = 0;
+    uint8_t* data = codec.encode(&len, 1, std::string("checked"));
+    std::vector<uint8_t> packet(sizeof(uint32_t) + len);
+    uint32_t packet_len = (uint32_t)packet.size();
+    memcpy(packet.data(), &packet_len, sizeof(uint32_t));
+    memcpy(packet.data() + sizeof(uint32_t), data, len);
+
+    lua_State* L = luaL_newstate();
+    slice pslice(packet.data(), packet.size());
+    codec.set_slice(&pslice);
+    TEST_CHECK(codec.load_packet(packet.size()) == (int)packet.size());
+    //校验之后改写校验和，decode没有再次计算
+    packet.back() ^= 0xff;
+    slice body(packet.data() + sizeof(uint32_t), len);
+    codec.set_slice(&body);
+    TEST_CHECK(codec.decode(L) == 1 && lua_tostring(L, -1) == std::string("checked"));
+    lua_settop(L, 0);
+    //未经load_packet的数据需要校验
+    bool thrown = false;
+    try {
+        codec.decode(L, packet.data() + sizeof(uint32_t), len);
+    } catch (const std::exception&) {
+        thrown = true;
+    }
+    TEST_CHECK(thrown);
+    codec.set_slice(&pslice);
+    TEST_CHECK(codec.load_packet(packet.size()) == -1);
+    codec.set_slice(nullptr);
+    lua_close(L);
+}
+
+void test_crc() {
+    test_crc_value();
+    test_crc_packet();
+    printf("test_crc done\n");
+}
@@ -0,0 +1,82 @@
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "lua_buff.h"
+#include "test_case.h"
+
+using namespace luakit;
+
+static void set_nonblock(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+//write_to/read_from交替收发，数据需逐字节一致
+static void test_fdio_roundtrip(int rfd, int wfd) {
+    const size_t total = 3 * 1024 * 1024 + 123;
+    luabuf out, in;
+    for (size_t i = 0; i < total; ++i) {
+        out.write<uint8_t>((uint8_t)(i * 7));
+    }
+    TEST_CHECK(out.size() == total);
+    size_t recv = 0;
+    bool ok = true;
+    while (recv < total && ok) {
+        size_t len = 0;
+        int res = out.write_to(wfd, &len);
+        TEST_CHECK(res == io_ok || res == io_again);
+        res = in.read_from(rfd, &len);
+        TEST_CHECK(res == io_ok || res == io_again);
+        //校验后移除，保持buff较小
+        size_t data_len = 0;
+        uint8_t* data = in.data(&data_len);
+        for (size_t i = 0; i < data_len; ++i) {
+            if (data[i] != (uint8_t)((recv + i) * 7)) {
+                ok = false;
+                break;
+            }
+        }
+        recv += data_len;
+        in.pop_size(data_len);
+    }
+    TEST_CHECK(ok);
+    TEST_CHECK(recv == total);
+    TEST_CHECK(out.empty());
+    //无数据时返回io_again
+    TEST_CHECK(in.read_from(rfd) == io_again);
+}
+
+static void test_fdio_socketpair() {
+    int fds[2];
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    set_nonblock(fds[0]);
+    set_nonblock(fds[1]);
+    test_fdio_roundtrip(fds[0], fds[1]);
+    //对端关闭后返回io_eof
+    close(fds[1]);
+    luabuf in;
+    TEST_CHECK(in.read_from(fds[0]) == io_eof);
+    close(fds[0]);
+}
+
+static void test_fdio_pipe() {
+    int fds[2];
+    TEST_CHECK(pipe(fds) == 0);
+    set_nonblock(fds[0]);
+    set_nonblock(fds[1]);
+    test_fdio_roundtrip(fds[0], fds[1]);
+    close(fds[1]);
+    luabuf in;
+    TEST_CHECK(in.read_from(fds[0]) == io_eof);
+    close(fds[0]);
+}
+
+void test_fdio() {
+    test_fdio_socketpair();
+    test_fdio_pipe();
+    printf("test_fdio done\n");
+}
+#else
+void test_fdio() {}
+#endif
@@ -0,0 +1,134 @@
+#include "lua_kit.h"
+#include "test_case.h"
+
+#include <random>
+
+using namespace luakit;
+
+static void run_check(kit_state& kit, cpchar script) {
+    TEST_CHECK(kit.run_script(script, [](std::string_view err) {
+        printf("test_lz error: %s\n", err.data());
+    }));
+}
+
+static std::vector<uint8_t> lz_pack(const std::vector<uint8_t>& src) {
+    std::vector<uint8_t> dest(lz_bound(src.size()));
+    dest.resize(lz_compress(src.data(), src.size(), dest.data()));
+    return dest;
+}
+
+static bool lz_unpack(const std::vector<uint8_t>& packed, size_t raw_len, std::vector<uint8_t>& out) {
+    out.assign(raw_len, 0);
+    return lz_decompress(packed.data(), packed.size(), out.data(), raw_len);
+}
+
+//往返：空数据、短于匹配下限、重复、重叠匹配、不可压缩的随机数据、超过最大偏移的长数据
+static void test_lz_roundtrip() {
+    std::mt19937 rng(7);
+    std::vector<std::vector<uint8_t>> inputs;
+    inputs.emplace_back();
+    inputs.emplace_back(std::vector<uint8_t>{ 1, 2, 3 });
+    inputs.emplace_back(std::vector<uint8_t>(5000, 'a'));
+    std::vector<uint8_t> overlap;
+    for (size_t i = 0; i < 3000; ++i) overlap.push_back("abc"[i % 3]);
+    inputs.push_back(overlap);
+    std::vector<uint8_t> noise(100000);
+    for (auto& c : noise) c = (uint8_t)rng();
+    inputs.push_back(noise);
+    std::vector<uint8_t> mixed;
+    while (mixed.size() < 300000) {
+        size_t run = rng() % 64;
+        if (rng() % 2) {
+            mixed.insert(mixed.end(), run, (uint8_t)rng());
+        } else {
+            for (size_t i = 0; i < run; ++i) mixed.push_back((uint8_t)rng());
+        }
+    }
+    inputs.push_back(mixed);
+    for (const auto& src : inputs) {
+        std::vector<uint8_t> packed = lz_pack(src);
+        TEST_CHECK(packed.size() <= lz_bound(src.size()));
+        std::vector<uint8_t> out;
+        TEST_CHECK(lz_unpack(packed, src.size(), out) && out == src);
+    }
+    //不可压缩的数据不超过上界，重复数据确实被压缩
+    TEST_CHECK(lz_pack(noise).size() >= noise.size());
+    TEST_CHECK(lz_pack(inputs[2]).size() < 64);
+}
+
+//错误的数据返回false，不越界读写(ASan下运行)
+static void test_lz_malformed() {
+    std::vector<uint8_t> src(4000);
+    for (size_t i = 0; i < src.size(); ++i) src[i] = (uint8_t)(i % 7 + i / 500);
+    std::vector<uint8_t> packed = lz_pack(src);
+    std::vector<uint8_t> out;
+    //长度不一致
+    TEST_CHECK(!lz_unpack(packed, src.size() - 1, out));
+    TEST_CHECK(!lz_unpack(packed, src.size() + 1, out));
+    //截断
+    for (size_t n : { (size_t)1, (size_t)2, packed.size() / 2, packed.size() - 1 }) {
+        std::vector<uint8_t> cut(packed.begin(), packed.begin() + n);
+        TEST_CHECK(!lz_unpack(cut, src.size(), out));
+    }
+    //偏移为0、偏移超出已解压的数据
+    TEST_CHECK(!lz_unpack({ 0x10, 'a', 0x00, 0x00 }, 5, out));
+    TEST_CHECK(!lz_unpack({ 0x10, 'a', 0x02, 0x00 }, 5, out));
+    //字面量长度超出输入
+    TEST_CHECK(!lz_unpack({ 0xf0, 0xff, 0xff, 0x10 }, 600, out));
+    //随机改写，结果可以成功或失败，但不能越界
+    std::mt19937 rng(11);
+    for (size_t i = 0; i < 2000; ++i) {
+        std::vector<uint8_t> bad = packed;
+        for (size_t j = 0; j < 4; ++j) bad[rng() % bad.size()] = (uint8_t)rng();
+        lz_unpack(bad, src.size(), out);
+    }
+}
+
+//lua接口，以及codec的压缩帧：解压与压缩交替进行，错误的帧抛出异常
+static void test_lz_codec() {
+    kit_state kit;
+    run_check(kit, R"LUA(
+        for _, s in ipairs({ "", "x", string.rep("luakit", 1000), string.pack("<i8i8i8", 1, -1, 12345) }) do
+            assert(luakit.decompress(luakit.compress(s)) == s)
+        end
+        local z = luakit.compress(string.rep("ab", 500))
+        assert(not pcall(luakit.decompress, z:sub(1, #z - 1)))
+        assert(not pcall(luakit.decompress, "\255\255\255\255\255\255\255\255\255\255"))
+    )LUA");
+    kit.close();
+
+    luabuf buf;
+    luacodec codec;
+    codec.set_buff(&buf);
+    codec.enable_compress(64);
+    size_t len = 0;
+    uint8_t* data = codec.encode(&len, 1, std::string(4096, 'z'));
+    std::vector<uint8_t> frame(data, data + len);
+    TEST_CHECK(!frame.empty());
+    if (frame.empty()) return;
+    TEST_CHECK(frame.back() == frame_lz && frame.size() < 256);
+    for (size_t i = 0; i < 3; ++i) {
+        std::string out;
+        codec.decode(frame.data(), frame.size(), out);
+        TEST_CHECK(out == std::string(4096, 'z'));
+        data = codec.encode(&len, 1, std::string(2048 + i, 'y'));
+        TEST_CHECK(data[len - 1] == frame_lz);
+    }
+    std::vector<uint8_t> bad = frame;
+    bad[bad.size() - 2] ^= 0x01;
+    bool thrown = false;
+    try {
+        std::string out;
+        codec.decode(bad.data(), bad.size(), out);
+    } catch (const std::exception&) {
+        thrown = true;
+    }
+    TEST_CHECK(thrown);
+}
+
+void test_lz() {
+    test_lz_roundtrip();
+    test_lz_malformed();
+    test_lz_codec();
+    printf("test_lz done\n");
+}
@@ -0,0 +1,45 @@
+#include "lua_kit.h"
+#include "test_case.h"
+
+using namespace luakit;
+
+static void run_check(kit_state& kit, cpchar script) {
+    TEST_CHECK(kit.run_script(script, [](std::string_view err) {
+        printf("test_mmap error: %s\n", err.data());
+    }));
+}
+
+//encode写入临时文件，映射后原地解码；空文件、关闭后、不存在的文件报错而不是崩溃
+void test_mmap() {
+    kit_state kit;
+    run_check(kit, R"LUA(
+        local path = os.tmpname()
+        local src = { id = 7, name = "mapped", list = { 1, 2.5, "x", { deep = true } } }
+        local f = io.open(path, "wb")
+        f:write(luakit.encode(src))
+        f:close()
+        local m = luakit.mmap(path)
+        assert(m.file_size() > 0 and m.size() == m.file_size())
+        for _ = 1, 2 do
+            local t = luakit.decode_slice(m)
+            assert(t.id == 7 and t.name == "mapped" and t.list[2] == 2.5 and t.list[4].deep)
+        end
+        m.recv(1)
+        assert(m.size() == m.file_size() - 1)
+        m.rewind()
+        assert(m.size() == m.file_size())
+        m.close()
+        assert(m.size() == 0 and m.file_size() == 0)
+        f = io.open(path, "wb")
+        f:close()
+        local e = luakit.mmap(path)
+        assert(e.file_size() == 0 and e.size() == 0)
+        e.close()
+        os.remove(path)
+        local ok, err = pcall(luakit.mmap, path)
+        assert(not ok and err:find("mmap"))
+        assert(not pcall(luakit.decode_slice, nil))
+    )LUA");
+    kit.close();
+    printf("test_mmap done\n");
+}
@@ -0,0 +1,129 @@
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "lua_ring.h"
+#include "test_case.h"
+
+using namespace luakit;
+
+//流式写入：每次写入3000字节，读走后保留100字节未读
+//回绕处经space_iov分两段写入，不扩容也不移动数据
+static void test_ring_wrap() {
+    ring_buf ring;
+    uint8_t expect = 0, next = 0;
+    size_t wraps = 0;
+    for (int i = 0; i < 100000; ++i) {
+        iovec iov[2] = {};
+        size_t n = ring.space_iov(iov, 2, 3000);
+        TEST_CHECK(n > 0);
+        if (n == 0) return;
+        wraps += (n == 2 && iov[0].iov_len < 3000) ? 1 : 0;
+        size_t left = 3000;
+        for (size_t k = 0; k < n && left > 0; ++k) {
+            size_t len = std::min(left, iov[k].iov_len);
+            for (size_t j = 0; j < len; ++j) {
+                ((uint8_t*)iov[k].iov_base)[j] = next++;
+            }
+            left -= len;
+        }
+        TEST_CHECK(left == 0);
+        ring.pop_space(3000);
+        size_t len = ring.size() - 100;
+        uint8_t buf[4000];
+        TEST_CHECK(ring.pop_data(buf, len) == len);
+        for (size_t j = 0; j < len; ++j) {
+            if (buf[j] != expect++) {
+                TEST_CHECK(false);
+                return;
+            }
+        }
+    }
+    TEST_CHECK(wraps > 0);
+    TEST_CHECK(ring.size() == 100);
+    TEST_CHECK(ring.capacity() == BUFFER_DEF);
+}
+
+//peek_space只返回尾部的连续空间：跨过回绕点时返回nullptr，不扩容也不移动已有数据
+static void test_ring_peek_space() {
+    ring_buf ring;
+    std::vector<uint8_t> data(BUFFER_DEF - 100, 7);
+    ring.push_data(data.data(), data.size());
+    ring.pop_size(data.size() - 10);
+    iovec iov[2] = {};
+    TEST_CHECK(ring.peek_iov(iov, 2) == 1);
+    uint8_t* head = (uint8_t*)iov[0].iov_base;
+    TEST_CHECK(ring.peek_space(50) != nullptr);
+    TEST_CHECK(ring.peek_space(200) == nullptr);
+    TEST_CHECK(ring.capacity() == BUFFER_DEF);
+    TEST_CHECK(ring.peek_iov(iov, 2) == 1 && iov[0].iov_base == head);
+    //总空间不足时扩容
+    TEST_CHECK(ring.peek_space(BUFFER_DEF) != nullptr);
+    TEST_CHECK(ring.capacity() > BUFFER_DEF && ring.size() == 10);
+}
+
+//跨过回绕点的数据通过peek_copy和peek_iov读取
+static void test_ring_segments() {
+    ring_buf ring;
+    std::vector<uint8_t> data(BUFFER_DEF - 10, 1);
+    ring.push_data(data.data(), data.size());
+    ring.pop_size(data.size() - 4);
+    uint32_t val = 0x01020304;
+    for (int i = 0; i < 4; ++i) {
+        ring.push_data((cpbyte)&val, sizeof(val));
+    }
+    TEST_CHECK(ring.wrapped());
+    uint32_t out = 0;
+    TEST_CHECK(ring.peek_value(&out, 12) && out == val);
+    iovec iov[2] = {};
+    TEST_CHECK(ring.peek_iov(iov, 2) == 2);
+    TEST_CHECK(iov[0].iov_len + iov[1].iov_len == ring.size());
+}
+
+#ifndef WIN32
+//回绕的数据经gather_iov/writev发出，consume_iov消费；对端readv写入回绕的空闲区域
+static void test_ring_iov() {
+    int fds[2];
+    TEST_CHECK(pipe(fds) == 0);
+    ring_buf out, in;
+    std::vector<uint8_t> fill(BUFFER_DEF - 8, 0);
+    out.push_data(fill.data(), fill.size());
+    out.pop_size(fill.size() - 1);
+    in.push_data(fill.data(), fill.size());
+    in.pop_size(fill.size() - 4);
+    std::vector<uint8_t> data(64);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = (uint8_t)i;
+    out.push_data(data.data(), data.size());
+    out.pop_size(1);
+    TEST_CHECK(out.wrapped());
+    iovec iov[4] = {};
+    size_t n = gather_iov(iov, 4, &out);
+    TEST_CHECK(n == 2);
+    ssize_t len = writev(fds[1], iov, (int)n);
+    TEST_CHECK(len == 64);
+    TEST_CHECK(consume_iov(20, &out) == 0 && out.size() == 44);
+    TEST_CHECK(consume_iov(len - 20, &out) == 0 && out.empty());
+
+    n = in.space_iov(iov, 4, 64);
+    TEST_CHECK(n == 2);
+    len = readv(fds[0], iov, (int)n);
+    TEST_CHECK(len == 64);
+    in.pop_space(len);
+    TEST_CHECK(in.wrapped() && in.size() == 68);
+    in.pop_size(4);
+    uint8_t back[64] = {};
+    TEST_CHECK(in.pop_data(back, 64) == 64 && memcmp(back, data.data(), 64) == 0);
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
+void test_ring() {
+    test_ring_wrap();
+    test_ring_peek_space();
+    test_ring_segments();
+#ifndef WIN32
+    test_ring_iov();
+#endif
+    printf("test_ring done\n");
+}
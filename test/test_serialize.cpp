@@ -0,0 +1,222 @@
+#include "lua_kit.h"
+#include "test_case.h"
+
+using namespace luakit;
+
+static void run_check(kit_state& kit, cpchar script) {
+    TEST_CHECK(kit.run_script(script, [](std::string_view err) {
+        printf("test_serialize error: %s\n", err.data());
+    }));
+}
+
+//比较函数：区分整数和浮点数、-0.0，NaN与NaN相等
+static const char* serialize_same = R"LUA(
+    function same(a, b)
+        if type(a) ~= type(b) then return false end
+        if type(a) == "number" then
+            if math.type(a) ~= math.type(b) then return false end
+            if a ~= a then return b ~= b end
+            if a == 0 and math.type(a) == "float" then return 1 / a == 1 / b end
+            return a == b
+        end
+        if type(a) ~= "table" then return a == b end
+        for k, v in pairs(a) do
+            if not same(v, b[k]) then return false end
+        end
+        for k in pairs(b) do
+            if a[k] == nil then return false end
+        end
+        return true
+    end
+    function round(v, line)
+        local s = string.serialize(v, line)
+        local o, err = string.unserialize(s)
+        assert(err == nil, err)
+        assert(same(v, o), s)
+        return s
+    end
+)LUA";
+
+//数值：整数边界、特殊浮点数、需要17位有效数字的浮点数，整数和浮点数类型不变
+static void test_serialize_number() {
+    kit_state kit;
+    run_check(kit, serialize_same);
+    run_check(kit, R"LUA(
+        local nums = {
+            0, 1, -1, math.maxinteger, math.mininteger, math.mininteger + 1,
+            0.0, -0.0, 1.0, -1.0, 0/0, 1/0, -1/0, 0.1, 0.1 + 0.2, 1/3, math.pi, -math.pi,
+            2^53, 2^53 + 2, 2^63, -2^63, 1e300, 5e-324, 2.2250738585072014e-308, 1.7976931348623157e308,
+        }
+        for _, v in ipairs(nums) do
+            round(v)
+            round({ v })
+            round({ [1.5] = v, k = v })
+        end
+        assert(string.serialize(math.mininteger) == "0x8000000000000000")
+        assert(string.serialize(0.1 + 0.2) == "0.30000000000000004")
+        assert(string.serialize(1.0) == "1.0" and string.serialize(-0.0) == "-0.0")
+        assert(string.serialize(1/0) == "1/0" and string.serialize(-1/0) == "-1/0")
+    )LUA");
+    kit.close();
+}
+
+//字符串：每个控制字符、引号和反斜杠、内嵌\0后接数字、跨SIMD块宽度的长串
+static void test_serialize_string() {
+    kit_state kit;
+    run_check(kit, serialize_same);
+    run_check(kit, R"LUA(
+        local bytes = {}
+        for i = 0, 255 do bytes[#bytes + 1] = string.char(i) end
+        local all = table.concat(bytes)
+        local s = round(all)
+        assert(not s:find("[\0-\31]"), "raw control byte")
+        round("a\0b\0001\0" .. "123")
+        round("'\"\\\n\r\t")
+        --转义字符落在16字节块的每个位置，以及块边界前后
+        for _, n in ipairs({ 15, 16, 17, 31, 32, 33, 64, 255, 1000 }) do
+            local plain = string.rep("x", n)
+            round(plain)
+            for i = 1, n, (n > 64) and 13 or 1 do
+                for _, c in ipairs({ "\0", "\1", "\31", "'", "\\", "\n" }) do
+                    round(plain:sub(1, i - 1) .. c .. plain:sub(i + 1))
+                end
+            end
+        end
+        --0x20以上(含0x7f和高位字节)原样输出
+        local high = string.rep("\127\128\255 ~", 20)
+        assert(string.serialize(high) == "'" .. high .. "'")
+    )LUA");
+    kit.close();
+}
+
+//键：关键字和非标识符加方括号，普通标识符直接输出，非字符串键
+static void test_serialize_key() {
+    kit_state kit;
+    run_check(kit, serialize_same);
+    run_check(kit, R"LUA(
+        local keywords = { "and", "break", "do", "else", "elseif", "end", "false", "for", "function", "goto", "if",
+            "in", "local", "nil", "not", "or", "repeat", "return", "then", "true", "until", "while" }
+        for _, k in ipairs(keywords) do
+            local s = round({ [k] = 1 })
+            assert(s == "{['" .. k .. "']=1}", s)
+        end
+        assert(string.serialize({ _end = 1 }) == "{_end=1}")
+        assert(string.serialize({ ["1a"] = 1 }) == "{['1a']=1}")
+        round({ [""] = 1, ["a b"] = 2, ["end_"] = 3, [true] = 4, [false] = 5, [-1] = 6, [2.5] = 7, [0x7fffffff] = 8 })
+        round({ 1, 2, { 3, { x = 4, ["nil"] = { [""] = "" } } } }, 1)
+        round({ a = { b = { c = {} } } }, 1)
+    )LUA");
+    kit.close();
+}
+
+//嵌套层数：128层可以解析，超过时返回错误
+static void test_unserialize_depth() {
+    kit_state kit;
+    run_check(kit, R"LUA(
+        local function nest(n) return string.rep("{", n) .. string.rep("}", n) end
+        local t, err = string.unserialize(nest(128))
+        assert(type(t) == "table" and err == nil, err)
+        local depth = 1
+        while t[1] do
+            t = t[1]
+            depth = depth + 1
+        end
+        assert(depth == 128 and next(t) == nil)
+        t, err = string.unserialize(nest(129))
+        assert(t == nil and err:find("unserialize"), err)
+        t, err = string.unserialize("{a=" .. nest(200) .. "}")
+        assert(t == nil and err, err)
+    )LUA");
+    kit.close();
+}
+
+//表项按256个一批写入：批次边界前后的数组、哈希和混合表，值为nil的项
+static void test_unserialize_chunk() {
+    kit_state kit;
+    run_check(kit, serialize_same);
+    run_check(kit, R"LUA(
+        for _, n in ipairs({ 1, 255, 256, 257, 511, 512, 513, 1000 }) do
+            local arr, map, mix = {}, {}, {}
+            for i = 1, n do
+                arr[i] = i
+                map["k" .. i] = i * 2
+                mix[i] = -i
+                mix["m" .. i] = { i }
+            end
+            round(arr)
+            round(map)
+            round(mix)
+            --位置项与键值项交错
+            local parts = {}
+            for i = 1, n do parts[#parts + 1] = i .. ",x" .. i .. "=" .. i end
+            local t = assert(string.unserialize("{" .. table.concat(parts, ",") .. "}"))
+            assert(#t == n and t[n] == n and t["x" .. n] == n)
+        end
+        local t = assert(string.unserialize("{1,nil,3;[5]=nil,x=nil}"))
+        assert(t[1] == 1 and t[2] == nil and t[3] == 3 and next(t, 3) == nil)
+    )LUA");
+    kit.close();
+}
+
+//错误的输入返回nil和错误信息，不执行其中的任何代码
+static void test_unserialize_malformed() {
+    kit_state kit;
+    run_check(kit, R"LUA(
+        hit = nil
+        probe = function() hit = true end
+        local bad = {
+            "os.exit()", "probe()", "{probe()}", "{x=probe()}", "{[probe()]=1}", "(function() hit = true end)()",
+            "{", "}", "{1,,2}", "{1 2}", "{[nil]=1}", "{[0/0]=1}", "{x}", "{x==1}", "{a=}",
+            "'abc", "'a\nb'", "'\\q'", "'\\256'", "'\\x1'", "'\\u{110000}'",
+            "0x", "1e", "--1", "1..2", "1/", "abc", "nil nil", "{} {}", "\0",
+            "{" .. string.rep("1,", 300) .. "probe()}",
+        }
+        for _, s in ipairs(bad) do
+            local t, err = string.unserialize(s)
+            assert(t == nil and type(err) == "string", s)
+        end
+        assert(hit == nil)
+        --空内容为nil，空白被忽略
+        assert(string.unserialize("") == nil and string.unserialize("  \n") == nil)
+        assert(string.unserialize(" { 1 , 2 } ")[2] == 2)
+        --lua的转义写法
+        assert(string.unserialize([['\65\066\x43\u{44}\z
+            E\'"']]) == "ABCDE'\"")
+        assert(string.unserialize('"a\\\nb"') == "a\nb")
+        --不是字符串的参数按lua的规则报错
+        assert(not pcall(string.unserialize, {}))
+    )LUA");
+    kit.close();
+}
+
+//往返：带缩进的输出、文件中常见的写法都能读回
+static void test_unserialize_roundtrip() {
+    kit_state kit;
+    run_check(kit, serialize_same);
+    run_check(kit, R"LUA(
+        local v = {
+            id = 1001, name = "player\0'01'", score = 99.5, flags = { true, false },
+            items = { { id = 1, count = 2 }, { id = 2, count = -3 } },
+            [10] = math.mininteger, [0.5] = 0/0, ["end"] = -0.0,
+        }
+        round(v)
+        round(v, 1)
+        local t = assert(string.unserialize("{ a = 1, b = { 2, 3; }, ['c'] = \"d\", [ 4 ] = -1e2, e = 0xff, f = -0x10 }"))
+        assert(same(t, { a = 1, b = { 2, 3 }, c = "d", [4] = -100.0, e = 255, f = -16 }))
+        assert(string.unserialize("9223372036854775808") == 2^63)
+        assert(math.type(string.unserialize("9223372036854775807")) == "integer")
+        assert(string.unserialize("0xffffffffffffffff") == -1)
+    )LUA");
+    kit.close();
+}
+
+void test_serialize() {
+    test_serialize_number();
+    test_serialize_string();
+    test_serialize_key();
+    test_unserialize_depth();
+    test_unserialize_chunk();
+    test_unserialize_malformed();
+    test_unserialize_roundtrip();
+    printf("test_serialize done\n");
+}
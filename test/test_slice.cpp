@@ -0,0 +1,88 @@
+#include "lua_kit.h"
+#include "test_case.h"
+
+using namespace luakit;
+
+static void run_check(kit_state& kit, cpchar script) {
+    TEST_CHECK(kit.run_script(script, [](std::string_view err) {
+        printf("test_slice error: %s\n", err.data());
+    }));
+}
+
+//数组打包往返，负数和超长的个数应报错或返回nil，不能回绕成巨大的长度
+static void test_slice_array() {
+    kit_state kit;
+    luabuf buf;
+    buf.push_data((cpbyte)"\x01\x00\x02\x00\x03\x00", 6);
+    kit.set("arr_slice", buf.get_slice());
+    run_check(kit, R"LUA(
+        local s = luakit.pack_array("h", { 1, -2, 3 })
+        assert(#s == 6 and string.unpack("<i2i2i2", s) == 1)
+        assert(select(2, string.unpack("<i2i2i2", s)) == -2)
+        local ok, err = pcall(arr_slice.read_array, "h", -1)
+        assert(not ok and err:find("non%-negative"))
+        assert(arr_slice.read_array("l", math.maxinteger // 4) == nil)
+        local t = arr_slice.read_array("h", 3)
+        assert(t[1] == 1 and t[2] == 2 and t[3] == 3)
+    )LUA");
+    kit.close();
+}
+
+//批量翻转与逐个翻转一致，覆盖向量宽度前后的个数以及原地翻转
+template <typename T>
+static void check_byteswap() {
+    for (size_t count = 0; count < 70; ++count) {
+        std::vector<T> src(count), dest(count);
+        for (size_t i = 0; i < count; ++i) src[i] = (T)(0x0102030405060708ull * (i + 1));
+        byteswap_array(dest.data(), src.data(), count);
+        bool same = true;
+        for (size_t i = 0; i < count; ++i) same = same && dest[i] == byteswap(src[i]);
+        byteswap_array(dest.data(), dest.data(), count);
+        TEST_CHECK(same && dest == src);
+    }
+}
+
+static void test_slice_byteswap() {
+    check_byteswap<uint16_t>();
+    check_byteswap<uint32_t>();
+    check_byteswap<uint64_t>();
+}
+
+//varint往返，负数个数报错，个数超过剩余字节时返回nil且不消费
+static void test_slice_varints() {
+    kit_state kit;
+    luabuf buf;
+    run_check(kit, R"LUA(
+        vint_data = luakit.pack_varints({ 0, 127, 128, -1, math.mininteger }, true)
+    )LUA");
+    std::string data = kit.get<std::string>("vint_data");
+    buf.push_data((cpbyte)data.data(), data.size());
+    kit.set("vint_slice", buf.get_slice());
+    run_check(kit, R"LUA(
+        local ok, err = pcall(vint_slice.varints, -1)
+        assert(not ok and err:find("non%-negative"))
+        assert(vint_slice.varints(math.maxinteger) == nil)
+        local t = vint_slice.varints(5, true)
+        assert(t[1] == 0 and t[2] == 127 and t[3] == 128 and t[4] == -1 and t[5] == math.mininteger)
+    )LUA");
+    kit.close();
+}
+
+//未开启统计时buff_stats返回nil
+static void test_buff_stats() {
+    kit_state kit;
+#ifdef LUAKIT_BUFF_STATS
+    run_check(kit, "luakit.encode({ 1, 2, 3 }); local t, b = luakit.buff_stats(); assert(t.peak > 0 and b.peak > 0)");
+#else
+    run_check(kit, "assert(luakit.buff_stats() == nil)");
+#endif
+    kit.close();
+}
+
+void test_slice() {
+    test_slice_array();
+    test_slice_byteswap();
+    test_slice_varints();
+    test_buff_stats();
+    printf("test_slice done\n");
+}
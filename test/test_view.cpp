@@ -0,0 +1,83 @@
+#include "lua_kit.h"
+#include "test_case.h"
+
+using namespace luakit;
+
+//视图的sub/byte/find下标与string.sub/byte/find逐一对比
+static const char* VIEW_POS_SCRIPT = R"LUA(
+    local str = view_slice.string()
+    local v = view_slice.view()
+    view_fails = 0
+    local function check(a, b, what)
+        if a ~= b then
+            view_fails = view_fails + 1
+            print("view mismatch", what, a, b)
+        end
+    end
+    local n = #str
+    for i = -n - 2, n + 2 do
+        for j = -n - 2, n + 2 do
+            check(v:sub(i, j):string(), str:sub(i, j), "sub " .. i .. "," .. j)
+            check(table.concat({ v:byte(i, j) }, ","), table.concat({ str:byte(i, j) }, ","), "byte " .. i .. "," .. j)
+        end
+        check(v:sub(i):string(), str:sub(i), "sub " .. i)
+        check(table.concat({ v:find("", i) }, ","), table.concat({ str:find("", i, true) }, ","), "find " .. i)
+        check(table.concat({ v:find("c", i) }, ","), table.concat({ str:find("c", i, true) }, ","), "find c " .. i)
+    end
+    check(#v:sub(1, 0), 0, "sub 1,0")
+    check(#v:sub(math.mininteger, math.mininteger), 0, "sub mininteger")
+    view_keep = v:sub(2, 3)
+)LUA";
+
+static void test_view_pos() {
+    kit_state kit;
+    luabuf buf;
+    buf.push_data((cpbyte)"abcdef", 6);
+    kit.set("view_slice", buf.get_slice());
+    TEST_CHECK(kit.run_script(VIEW_POS_SCRIPT, [](std::string_view err) {
+        printf("test_view_pos error: %s\n", err.data());
+    }));
+    TEST_CHECK(kit.get<int>("view_fails") == 0);
+    kit.close();
+}
+
+//slice随所属的luabuf析构后，视图应失效而不是访问已释放的内存
+static void test_view_owner() {
+    kit_state kit;
+    luabuf* buf = new luabuf();
+    buf->push_data((cpbyte)"abcdef", 6);
+    kit.set("view_slice", buf->get_slice());
+    TEST_CHECK(kit.run_script("view_keep = view_slice.view():sub(2, 3)"));
+    TEST_CHECK(kit.run_script("assert(view_keep:valid() and view_keep:string() == 'bc')"));
+    delete buf;
+    TEST_CHECK(kit.run_script("assert(not view_keep:valid())"));
+    TEST_CHECK(!kit.run_script("view_keep:string()"));
+    kit.close();
+}
+
+//ring_buf的视图：数据读走后，写入绕回覆盖其内存时视图失效；未覆盖时仍然有效
+static void test_view_ring() {
+    kit_state kit;
+    ring_buf ring;
+    std::vector<uint8_t> fill(BUFFER_DEF, 'x');
+    ring.push_data(fill.data(), BUFFER_DEF / 2);
+    ring.push_data((cpbyte)"abcdefgh", 8);
+    ring.pop_size(BUFFER_DEF / 2);
+    kit.set("ring_slice", ring.get_slice(6));
+    TEST_CHECK(kit.run_script("ring_view = ring_slice.view()"));
+    ring.pop_size(6);
+    ring.push_data(fill.data(), 100);
+    TEST_CHECK(kit.run_script("assert(ring_view:valid() and ring_view:string() == 'abcdef')"));
+    ring.pop_size(100);
+    ring.push_data(fill.data(), BUFFER_DEF - 4);
+    TEST_CHECK(ring.capacity() == BUFFER_DEF);
+    TEST_CHECK(kit.run_script("assert(not ring_view:valid())"));
+    kit.close();
+}
+
+void test_view() {
+    test_view_pos();
+    test_view_owner();
+    test_view_ring();
+    printf("test_view done\n");
+}